@@ -8,4 +8,5 @@ CONFIG += ordered
 
 TEMPLATE = subdirs
 
-SUBDIRS = src/painttyDesktop
+SUBDIRS = src/painttyDesktop \
+    tests/brushbenchmark
@@ -0,0 +1,297 @@
+#include "brushbenchmark.h"
+#include "layer.h"
+
+#include <QElapsedTimer>
+#include <QtMath>
+
+/*!
+    \class BrushBenchmark
+
+    \brief Measures how many dabs per second a brush draws.
+
+    The brush draws single dabs at scattered points of an offscreen
+    surface for a fixed time, either at full pressure or with pressure
+    sweeping through its range. Comparing both shows what pressure
+    costs per dab.
+
+    replay() draws the strokes of a fixed corpus instead, and keeps what
+    a single pass of each left on the surface, so renders can be checked
+    against golden images with compare(). The brushbenchmark test in
+    tests/ does both for every brush.
+*/
+
+qreal BrushBenchmark::Result::dabsPerSecond() const
+{
+    return msecs > 0 ? dabs * 1000.0 / msecs : 0;
+}
+
+QString BrushBenchmark::Result::toString() const
+{
+    return QString("%1, pressure %2: %3 %4/s")
+            .arg(brush)
+            .arg(pressure ? "on" : "off")
+            .arg(qRound64(dabsPerSecond()))
+            .arg(unit);
+}
+
+/*!
+    \fn BrushBenchmark::Result BrushBenchmark::run(const BrushPointer &brush,
+                                                  bool pressure,
+                                                  int msecs,
+                                                  const QSize &surface)
+
+    Lets \a brush draw dabs on a new layer of size \a surface for about
+    \a msecs milliseconds. The brush keeps the layer as its surface.
+*/
+
+BrushBenchmark::Result BrushBenchmark::run(const BrushPointer &brush,
+                                           bool pressure,
+                                           int msecs,
+                                           const QSize &surface)
+{
+    Result result;
+    result.pressure = pressure;
+    if(!brush){
+        return result;
+    }
+    result.brush = brush->name();
+    brush->setSurface(LayerPointer(new Layer("benchmark", surface)));
+
+    // a fixed sequence, so runs are comparable
+    quint32 seed = 1;
+    auto next = [&seed](){
+        seed = seed * 1103515245u + 12345u;
+        return (seed >> 8) & 0xffff;
+    };
+
+    QElapsedTimer timer;
+    timer.start();
+    qint64 elapsed = 0;
+    while(elapsed < msecs){
+        // check the clock every batch only
+        for(int i = 0; i < 64; ++i){
+            const QPoint point(next() % surface.width(),
+                               next() % surface.height());
+            const qreal p = pressure ? (next() % 1000 + 1) / 1000.0 : 1.0;
+            brush->drawPoint(point, p);
+            brush->takeDirtyRect();
+        }
+        result.dabs += 64;
+        elapsed = timer.elapsed();
+    }
+    result.msecs = elapsed;
+    return result;
+}
+
+/*!
+    \fn BrushBenchmark::Result BrushBenchmark::runStrokes(const BrushPointer &brush,
+                                                         bool pressure,
+                                                         int msecs,
+                                                         const QSize &surface,
+                                                         int length)
+
+    Lets \a brush draw strokes of segments \a length pixels long on a new
+    layer of size \a surface for about \a msecs milliseconds, turning by
+    a random angle at every point. Counts segments.
+*/
+
+BrushBenchmark::Result BrushBenchmark::runStrokes(const BrushPointer &brush,
+                                                  bool pressure,
+                                                  int msecs,
+                                                  const QSize &surface,
+                                                  int length)
+{
+    Result result;
+    result.unit = "segments";
+    result.pressure = pressure;
+    if(!brush){
+        return result;
+    }
+    result.brush = brush->name();
+    brush->setSurface(LayerPointer(new Layer("benchmark", surface)));
+
+    quint32 seed = 1;
+    auto next = [&seed](){
+        seed = seed * 1103515245u + 12345u;
+        return (seed >> 8) & 0xffff;
+    };
+
+    QElapsedTimer timer;
+    timer.start();
+    qint64 elapsed = 0;
+    while(elapsed < msecs){
+        // one stroke per batch, kept inside the surface
+        QPointF point(next() % surface.width(), next() % surface.height());
+        brush->drawPoint(point.toPoint(), 1.0);
+        for(int i = 0; i < 64; ++i){
+            const qreal angle = (next() % 3600) * M_PI / 1800;
+            point += QPointF(qCos(angle), qSin(angle)) * length;
+            point.rx() = qBound<qreal>(0, point.x(), surface.width() - 1);
+            point.ry() = qBound<qreal>(0, point.y(), surface.height() - 1);
+            const qreal p = pressure ? (next() % 1000 + 1) / 1000.0 : 1.0;
+            brush->drawLineTo(point.toPoint(), p);
+            brush->takeDirtyRect();
+        }
+        brush->endStroke();
+        result.dabs += 64;
+        elapsed = timer.elapsed();
+    }
+    result.msecs = elapsed;
+    return result;
+}
+
+/*!
+    \fn QVector<BrushBenchmark::Stroke> BrushBenchmark::corpus(const QSize &surface)
+
+    Returns the strokes replay() draws, fitted to \a surface: a straight
+    line, a curve, a line of varying pressure and a long scribble like a
+    sketch. They are the same on every call.
+*/
+
+QVector<BrushBenchmark::Stroke> BrushBenchmark::corpus(const QSize &surface)
+{
+    const qreal w = surface.width();
+    const qreal h = surface.height();
+    QVector<Stroke> strokes;
+
+    Stroke straight;
+    straight.name = "straight";
+    for(int i = 0; i < 64; ++i){
+        const qreal t = i / 63.0;
+        straight.points.append(QPointF(w * (0.1 + 0.8 * t),
+                                       h * (0.15 + 0.7 * t)).toPoint(), 1.0);
+    }
+    strokes.append(straight);
+
+    Stroke curved;
+    curved.name = "curved";
+    for(int i = 0; i < 128; ++i){
+        const qreal angle = i / 127.0 * 1.5 * M_PI;
+        curved.points.append(QPointF(w * (0.5 + 0.35 * qCos(angle)),
+                                     h * (0.5 + 0.35 * qSin(angle))).toPoint(),
+                             1.0);
+    }
+    strokes.append(curved);
+
+    Stroke pressure;
+    pressure.name = "pressure";
+    for(int i = 0; i < 128; ++i){
+        const qreal t = i / 127.0;
+        pressure.points.append(QPointF(w * (0.05 + 0.9 * t), h * 0.5).toPoint(),
+                               0.1 + 0.9 * qSin(t * M_PI));
+    }
+    strokes.append(pressure);
+
+    Stroke sketch;
+    sketch.name = "sketch";
+    for(int i = 0; i < 1024; ++i){
+        const qreal t = i / 1023.0 * 2 * M_PI;
+        sketch.points.append(QPointF(w * (0.5 + 0.4 * qSin(3 * t)),
+                                     h * (0.5 + 0.4 * qSin(4 * t))).toPoint(),
+                             0.5 + 0.5 * qSin(7 * t));
+    }
+    strokes.append(sketch);
+
+    return strokes;
+}
+
+qreal BrushBenchmark::Replay::segmentsPerSecond() const
+{
+    return nsecs > 0 ? segments * 1e9 / nsecs : 0;
+}
+
+qreal BrushBenchmark::Replay::nsecsPerPixel() const
+{
+    return pixels > 0 ? qreal(nsecs) / pixels : 0;
+}
+
+QString BrushBenchmark::Replay::toString() const
+{
+    return QString("%1, %2: %3 segments/s, %4 ns/pixel")
+            .arg(brush)
+            .arg(stroke)
+            .arg(qRound64(segmentsPerSecond()))
+            .arg(nsecsPerPixel(), 0, 'f', 2);
+}
+
+/*!
+    \fn BrushBenchmark::Replay BrushBenchmark::replay(const BrushPointer &brush,
+                                                     const Stroke &stroke,
+                                                     int msecs,
+                                                     const QSize &surface)
+
+    Lets \a brush draw \a stroke on a new white layer of size \a surface,
+    keeps the result, then draws it over and over for about \a msecs
+    milliseconds. The brush keeps the layer as its surface.
+*/
+
+BrushBenchmark::Replay BrushBenchmark::replay(const BrushPointer &brush,
+                                              const Stroke &stroke,
+                                              int msecs,
+                                              const QSize &surface)
+{
+    Replay result;
+    result.stroke = stroke.name;
+    if(!brush || stroke.points.isEmpty()){
+        return result;
+    }
+    result.brush = brush->name();
+    LayerPointer layer(new Layer("benchmark", surface));
+    layer->imagePtr()->fill(0xffffffff);
+    layer->markModified();
+    brush->setSurface(layer);
+
+    const StrokeBuffer &points = stroke.points;
+    auto pass = [&](){
+        brush->drawPoint(points.point(0), points.pressure(0));
+        qint64 pixels = 0;
+        auto count = [&](const QRect &dirty){
+            pixels += qint64(dirty.width()) * dirty.height();
+        };
+        count(brush->takeDirtyRect());
+        for(int i = 1; i < points.count(); ++i){
+            brush->drawLineTo(points.point(i), points.pressure(i));
+            count(brush->takeDirtyRect());
+        }
+        brush->endStroke();
+        count(brush->takeDirtyRect());
+        return pixels;
+    };
+
+    pass();
+    result.image = layer->snapshot().copy();
+
+    QElapsedTimer timer;
+    timer.start();
+    do{
+        result.pixels += pass();
+        result.segments += points.count() - 1;
+    }while(timer.elapsed() < msecs);
+    result.nsecs = timer.nsecsElapsed();
+    return result;
+}
+
+/*!
+    \fn int BrushBenchmark::compare(const QImage &image, const QImage &golden)
+
+    Returns the largest difference of any channel of any pixel between
+    \a image and \a golden, premultiplied, or -1 if their sizes differ.
+*/
+
+int BrushBenchmark::compare(const QImage &image, const QImage &golden)
+{
+    if(image.size() != golden.size()){
+        return -1;
+    }
+    const QImage a = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    const QImage b = golden.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    int worst = 0;
+    for(int y = 0; y < a.height(); ++y){
+        const uchar *pa = a.constScanLine(y);
+        const uchar *pb = b.constScanLine(y);
+        for(int i = 0; i < a.width() * 4; ++i){
+            worst = qMax(worst, qAbs(int(pa[i]) - int(pb[i])));
+        }
+    }
+    return worst;
+}
@@ -0,0 +1,67 @@
+#ifndef BRUSHBENCHMARK_H
+#define BRUSHBENCHMARK_H
+
+#include <QString>
+#include <QSize>
+#include <QImage>
+#include <QVector>
+#include "strokebuffer.h"
+#include "../paintingTools/brush/abstractbrush.h"
+
+typedef QSharedPointer<AbstractBrush> BrushPointer;
+
+class BrushBenchmark
+{
+public:
+    struct Result
+    {
+        Result():unit("dabs"), dabs(0), msecs(0), pressure(false){}
+        QString brush;
+        // what dabs counts
+        QString unit;
+        qint64 dabs;
+        qint64 msecs;
+        bool pressure;
+        qreal dabsPerSecond() const;
+        QString toString() const;
+    };
+
+    // a stroke of the replay corpus
+    struct Stroke
+    {
+        QString name;
+        StrokeBuffer points;
+    };
+
+    struct Replay
+    {
+        Replay():segments(0), pixels(0), nsecs(0){}
+        QString brush;
+        QString stroke;
+        qint64 segments;
+        // sum of the dirty rects the segments reported
+        qint64 pixels;
+        qint64 nsecs;
+        // the surface after a single pass of the stroke
+        QImage image;
+        qreal segmentsPerSecond() const;
+        qreal nsecsPerPixel() const;
+        QString toString() const;
+    };
+
+    static Result run(const BrushPointer &brush, bool pressure,
+                      int msecs = 1000,
+                      const QSize &surface = QSize(1024, 1024));
+    static Result runStrokes(const BrushPointer &brush, bool pressure,
+                             int msecs = 1000,
+                             const QSize &surface = QSize(1024, 1024),
+                             int length = 16);
+
+    static QVector<Stroke> corpus(const QSize &surface = QSize(512, 512));
+    static Replay replay(const BrushPointer &brush, const Stroke &stroke,
+                         int msecs = 500,
+                         const QSize &surface = QSize(512, 512));
+    static int compare(const QImage &image, const QImage &golden);
+};
+
+#endif // BRUSHBENCHMARK_H
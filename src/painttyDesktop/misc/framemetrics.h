@@ -0,0 +1,27 @@
+#ifndef FRAMEMETRICS_H
+#define FRAMEMETRICS_H
+
+#include <QString>
+#include <QElapsedTimer>
+
+class FrameMetrics
+{
+public:
+    explicit FrameMetrics(const QString &name, int window = 120);
+    bool isEnabled() const;
+    void setEnabled(bool enabled);
+    void begin();
+    void end();
+    void reset();
+    QString toString() const;
+private:
+    QString name_;
+    QElapsedTimer timer_;
+    bool enabled_;
+    int window_;
+    int frames_;
+    qint64 total_;
+    qint64 max_;
+};
+
+#endif // FRAMEMETRICS_H
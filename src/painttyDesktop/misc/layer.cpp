@@ -1,7 +1,78 @@
 #include "layer.h"
+#include "tilecodec.h"
 
 #include <QImage>
 #include <QColor>
+#include <QPainter>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QtConcurrent>
+#include <atomic>
+#include <cstring>
+
+/*!
+    \class Layer
+
+    Besides plain pixels, a layer can be packed: its pixels are held
+    as a grid of TILE_SIZE tiles encoded with the tile codec, and the
+    image is released. LayerCompressor decides which layers to pack.
+
+    imagePtr() and imageConstPtr() unpack a packed layer before they
+    return. paint() does not, it decodes only the tiles it draws, so
+    the compositor can show a packed layer without growing memory.
+
+    Asking for writable pixels does not change them. Whoever writes
+    calls markModified() afterwards, which drops the packed copy and
+    starts a new generation, so layers that are only looked at stay
+    idle and keep their packed copy.
+*/
+
+namespace {
+std::atomic<qint64> hits(0);
+std::atomic<qint64> misses(0);
+std::atomic<qint64> hit_nsecs(0);
+std::atomic<qint64> miss_nsecs(0);
+std::atomic<qint64> max_miss_nsecs(0);
+std::atomic<qint64> paint_decodes(0);
+std::atomic<qint64> paint_decode_nsecs(0);
+
+void recordMiss(qint64 nsecs)
+{
+    misses++;
+    miss_nsecs += nsecs;
+    qint64 prev = max_miss_nsecs;
+    while(prev < nsecs
+          && !max_miss_nsecs.compare_exchange_weak(prev, nsecs)){
+    }
+}
+
+QRect tileRect(int index, const QSize &size)
+{
+    const int columns = (size.width() + Layer::TILE_SIZE - 1) / Layer::TILE_SIZE;
+    return QRect((index % columns) * Layer::TILE_SIZE,
+                 (index / columns) * Layer::TILE_SIZE,
+                 Layer::TILE_SIZE, Layer::TILE_SIZE)
+            .intersected(QRect(QPoint(0, 0), size));
+}
+
+// decodes packed tile index into bits, a surface of size
+void unpackTile(uchar *bits, int bpl, const QSize &size,
+                int index, const QByteArray &packed)
+{
+    const QRect rect = tileRect(index, size);
+    QImage tile = decodeTile(packed);
+    if(tile.size() != rect.size()){
+        for(int y = rect.top(); y <= rect.bottom(); ++y){
+            memset(bits + y * bpl + rect.x() * 4, 0, rect.width() * 4);
+        }
+        return;
+    }
+    for(int y = 0; y < rect.height(); ++y){
+        memcpy(bits + (rect.y() + y) * bpl + rect.x() * 4,
+               tile.constScanLine(y), rect.width() * 4);
+    }
+}
+}
 
 Layer::Layer(const QString &name, const QSize &size)
     :lock_(false),
@@ -10,7 +81,10 @@ Layer::Layer(const QString &name, const QSize &size)
       touched_(false),
       access_(true),
       name_(name),
-      size_(size)
+      size_(size),
+      generation_(0),
+      last_access_(QDateTime::currentMSecsSinceEpoch()),
+      last_write_(last_access_)
 {
 }
 
@@ -79,28 +153,122 @@ void Layer::deselect()
 void Layer::clear()
 {
     img_.clear();
+    packed_.clear();
+    ++generation_;
     touched_ = false;
 }
 
-QImage* Layer::imagePtr()
+QImage* Layer::access()
 {
+    last_access_ = QDateTime::currentMSecsSinceEpoch();
     if(!touched_){
         create();
+        return img_.data();
+    }
+    QElapsedTimer timer;
+    timer.start();
+    if(img_.isNull()){
+        unpack();
+        recordMiss(timer.nsecsElapsed());
+    }else{
+        hits++;
+        hit_nsecs += timer.nsecsElapsed();
     }
     return img_.data();
 }
 
+void Layer::unpack()
+{
+    img_ = QSharedPointer<QImage>(new QImage(size_, QImage::Format_ARGB32_Premultiplied));
+    uchar *bits = img_->bits();
+    const int bpl = img_->bytesPerLine();
+    QVector<int> indexes(packed_.count());
+    for(int i = 0; i < indexes.count(); ++i){
+        indexes[i] = i;
+    }
+    QtConcurrent::blockingMap(indexes, [&](int index){
+        unpackTile(bits, bpl, size_, index, packed_[index]);
+    });
+}
+
+/*!
+    \fn QImage* Layer::imagePtr()
+
+    Returns the pixels to write to. Call markModified() once written.
+*/
+
+QImage* Layer::imagePtr()
+{
+    return access();
+}
+
 const QImage* Layer::imageConstPtr()
+{
+    return access();
+}
+
+/*!
+    \fn void Layer::markModified()
+
+    Records that the pixels were written, which makes the packed copy
+    stale.
+*/
+
+void Layer::markModified()
+{
+    packed_.clear();
+    ++generation_;
+    last_write_ = QDateTime::currentMSecsSinceEpoch();
+}
+
+/*!
+    \fn void Layer::paint(QPainter *painter, const QRect &source) const
+
+    Draws the \a source area of the layer at the origin of \a painter.
+    A packed layer stays packed, only the tiles under \a source are
+    decoded. This is safe to call from several threads at once, as long
+    as nothing writes to the layer meanwhile.
+*/
+
+void Layer::paint(QPainter *painter, const QRect &source) const
 {
     if(!touched_){
-        create();
+        return;
     }
-    return img_.data();
+    if(!img_.isNull()){
+        painter->drawImage(QPoint(0, 0), *img_, source);
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    const QRect area = source.intersected(QRect(QPoint(0, 0), size_));
+    const int columns = (size_.width() + TILE_SIZE - 1) / TILE_SIZE;
+    for(int ty = area.top() / TILE_SIZE; ty <= area.bottom() / TILE_SIZE; ++ty){
+        for(int tx = area.left() / TILE_SIZE; tx <= area.right() / TILE_SIZE; ++tx){
+            const int index = ty * columns + tx;
+            if(index >= packed_.count()){
+                continue;
+            }
+            const QRect rect = tileRect(index, size_);
+            const QRect part = rect.intersected(area);
+            painter->drawImage(part.topLeft() - source.topLeft(),
+                               decodeTile(packed_[index]),
+                               part.translated(-rect.topLeft()));
+        }
+    }
+    paint_decodes++;
+    paint_decode_nsecs += timer.nsecsElapsed();
 }
 
 void Layer::resize(const QSize &size)
 {
+    if(img_.isNull() && touched_){
+        access();
+    }
     size_ = size;
+    packed_.clear();
+    ++generation_;
     if(!img_.isNull()){
         if (img_->size() == size)
             return;
@@ -108,6 +276,192 @@ void Layer::resize(const QSize &size)
     }
 }
 
+bool Layer::isPacked() const
+{
+    return touched_ && img_.isNull();
+}
+
+qint64 Layer::residentBytes() const
+{
+    return img_.isNull() ? 0 : img_->byteCount();
+}
+
+qint64 Layer::lastAccess() const
+{
+    return last_access_;
+}
+
+qint64 Layer::lastWrite() const
+{
+    return last_write_;
+}
+
+quint64 Layer::generation() const
+{
+    return generation_;
+}
+
+QSize Layer::size() const
+{
+    return size_;
+}
+
+/*!
+    \fn QImage Layer::snapshot() const
+
+    Returns a shallow copy of the pixels, which can be read from another
+    thread while the layer keeps being painted on. Returns a null image
+    if the layer is not resident.
+*/
+
+QImage Layer::snapshot() const
+{
+    return img_.isNull() ? QImage() : *img_;
+}
+
+/*!
+    \fn QVector<QByteArray> Layer::packedTiles() const
+
+    Returns the packed copy of the pixels, which is shared, not copied.
+    It is empty if the layer was written since it was last packed.
+    \sa unpackTiles()
+*/
+
+QVector<QByteArray> Layer::packedTiles() const
+{
+    return packed_;
+}
+
+/*!
+    \fn bool Layer::release()
+
+    Drops the pixels if a packed copy of them is still valid.
+*/
+
+bool Layer::release()
+{
+    if(!touched_ || img_.isNull() || packed_.isEmpty()){
+        return false;
+    }
+    img_.clear();
+    return true;
+}
+
+/*!
+    \fn bool Layer::adopt(const QImage &image)
+
+    Makes \a image the pixels of the layer without copying them, when
+    the format and size already match. If the layer was painted on
+    before, \a image goes under what is there, as it is the older
+    content. Returns true if the layer now holds exactly \a image.
+*/
+
+bool Layer::adopt(const QImage &image)
+{
+    if(image.isNull()){
+        return false;
+    }
+    QImage adopted = image;
+    if(adopted.format() != QImage::Format_ARGB32_Premultiplied){
+        adopted = adopted.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    }
+    if(adopted.size() != size_){
+        QImage resized(size_, QImage::Format_ARGB32_Premultiplied);
+        resized.fill(Qt::transparent);
+        QPainter painter(&resized);
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+        painter.drawImage(0, 0, adopted);
+        painter.end();
+        adopted = resized;
+    }
+
+    if(touched_){
+        QPainter painter(imagePtr());
+        painter.setCompositionMode(QPainter::CompositionMode_DestinationOver);
+        painter.drawImage(0, 0, adopted);
+        painter.end();
+        markModified();
+        return false;
+    }
+    img_ = QSharedPointer<QImage>(new QImage(adopted));
+    touched_ = true;
+    packed_.clear();
+    ++generation_;
+    last_access_ = last_write_ = QDateTime::currentMSecsSinceEpoch();
+    return true;
+}
+
+/*!
+    \fn bool Layer::adoptPacked(quint64 generation, const QVector<QByteArray> &tiles)
+
+    Takes \a tiles, packed from a snapshot() taken at \a generation,
+    and releases the pixels. Fails if the layer was written since.
+*/
+
+bool Layer::adoptPacked(quint64 generation, const QVector<QByteArray> &tiles)
+{
+    if(generation != generation_ || !touched_ || img_.isNull()
+            || tiles.isEmpty()){
+        return false;
+    }
+    packed_ = tiles;
+    return release();
+}
+
+QVector<QByteArray> Layer::packTiles(const QImage &image)
+{
+    QVector<QByteArray> tiles;
+    if(image.isNull()){
+        return tiles;
+    }
+    const int columns = (image.width() + TILE_SIZE - 1) / TILE_SIZE;
+    const int rows = (image.height() + TILE_SIZE - 1) / TILE_SIZE;
+    tiles.reserve(columns * rows);
+    for(int i = 0; i < columns * rows; ++i){
+        const QRect rect = tileRect(i, image.size());
+        // a read-only view, encoding needs no copy of the tile
+        QImage tile(image.constScanLine(rect.y()) + rect.x() * 4,
+                    rect.width(), rect.height(),
+                    image.bytesPerLine(), image.format());
+        tiles.append(encodeTile(tile));
+    }
+    return tiles;
+}
+
+/*!
+    \fn QImage Layer::unpackTiles(const QVector<QByteArray> &tiles,
+                                  const QSize &size)
+
+    Decodes \a tiles, packed from a layer of \a size, into a new image.
+    Unlike unpacking a layer, it runs on the calling thread only, so
+    tasks on the thread pool can use it.
+*/
+
+QImage Layer::unpackTiles(const QVector<QByteArray> &tiles,
+                          const QSize &size)
+{
+    QImage image(size, QImage::Format_ARGB32_Premultiplied);
+    uchar *bits = image.bits();
+    const int bpl = image.bytesPerLine();
+    for(int i = 0; i < tiles.count(); ++i){
+        unpackTile(bits, bpl, size, i, tiles[i]);
+    }
+    return image;
+}
+
+Layer::Stats Layer::stats()
+{
+    Stats s;
+    s.hits = hits;
+    s.misses = misses;
+    s.hitNsecs = hit_nsecs;
+    s.missNsecs = miss_nsecs;
+    s.maxMissNsecs = max_miss_nsecs;
+    s.paintDecodes = paint_decodes;
+    s.paintDecodeNsecs = paint_decode_nsecs;
+    return s;
+}
+
 QString Layer::name() const
 {
     return name_;
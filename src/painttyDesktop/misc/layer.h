@@ -3,16 +3,41 @@
 
 #include <QSharedPointer>
 #include <QSize>
+#include <QRect>
+#include <QVector>
+#include <QByteArray>
 
 class QImage;
+class QPainter;
 
 class Layer
 {
 public:
+    enum : int {
+        // same grid as TileCompositor, so a composited tile
+        // never needs more than one packed tile per layer
+        TILE_SIZE = 256
+    };
+    // access counters of all layers, a miss means the pixels
+    // had to be unpacked first; paints of packed layers decode
+    // only what they draw and are counted apart
+    struct Stats
+    {
+        qint64 hits;
+        qint64 misses;
+        qint64 hitNsecs;
+        qint64 missNsecs;
+        qint64 maxMissNsecs;
+        qint64 paintDecodes;
+        qint64 paintDecodeNsecs;
+    };
+
     Layer(const QString &name, const QSize &size);
     ~Layer();
     QImage* imagePtr();
     const QImage* imageConstPtr();
+    void markModified();
+    void paint(QPainter *painter, const QRect &source) const;
     void resize(const QSize &size);
     bool isLocked() const;
     bool isHided() const;
@@ -27,6 +52,22 @@ public:
     void clear();
     QString name() const;
     void rename(const QString &new_name);
+
+    bool isPacked() const;
+    qint64 residentBytes() const;
+    qint64 lastAccess() const;
+    qint64 lastWrite() const;
+    quint64 generation() const;
+    QSize size() const;
+    QImage snapshot() const;
+    QVector<QByteArray> packedTiles() const;
+    bool release();
+    bool adopt(const QImage &image);
+    bool adoptPacked(quint64 generation, const QVector<QByteArray> &tiles);
+    static QVector<QByteArray> packTiles(const QImage &image);
+    static QImage unpackTiles(const QVector<QByteArray> &tiles,
+                              const QSize &size);
+    static Stats stats();
 private:
     Q_DISABLE_COPY(Layer)
     bool lock_;
@@ -37,7 +78,14 @@ private:
     QSharedPointer<QImage> img_;
     QString name_;
     QSize size_;
+    // packed copy of the pixels, valid until the next write
+    QVector<QByteArray> packed_;
+    quint64 generation_;
+    qint64 last_access_;
+    qint64 last_write_;
     void create();
+    QImage* access();
+    void unpack();
 };
 
 typedef QSharedPointer<Layer> LayerPointer;
@@ -0,0 +1,128 @@
+#include "layercompressor.h"
+#include "layermanager.h"
+
+#include <QImage>
+#include <QTimerEvent>
+#include <QDateTime>
+#include <QFutureWatcher>
+#include <QtConcurrent>
+#include <algorithm>
+
+/*!
+    \class LayerCompressor
+
+    \brief Packs idle layers to lower resident memory.
+
+    Every few seconds the resident layers are checked, least recently
+    used first. A layer is packed when it has been hidden for a while,
+    when it has not been written for the idle timeout, or while the
+    resident layers exceed the memory budget. The selected layer is
+    never packed, as the next stroke would unpack it right away.
+
+    Encoding runs on the global thread pool from a snapshot of the
+    layer. If the layer is written before encoding finishes, the result
+    is thrown away and the layer is tried again on a later round.
+*/
+
+LayerCompressor::LayerCompressor(LayerManager *layers, QObject *parent)
+    :QObject(parent),
+      layers_(layers),
+      memory_budget_(512*1024*1024),
+      idle_timeout_(60*1000),
+      hidden_timeout_(5*1000),
+      timer_id_(0)
+{
+    timer_id_ = startTimer(2000);
+}
+
+LayerCompressor::~LayerCompressor()
+{
+    if(timer_id_)
+        killTimer(timer_id_);
+}
+
+void LayerCompressor::setMemoryBudget(qint64 bytes)
+{
+    memory_budget_ = bytes;
+}
+
+void LayerCompressor::setIdleTimeout(int msecs)
+{
+    idle_timeout_ = msecs;
+}
+
+void LayerCompressor::setHiddenTimeout(int msecs)
+{
+    hidden_timeout_ = msecs;
+}
+
+qint64 LayerCompressor::residentBytes() const
+{
+    qint64 bytes = 0;
+    for(int i=0;i<layers_->count();++i){
+        bytes += layers_->layerFrom(i)->residentBytes();
+    }
+    return bytes;
+}
+
+void LayerCompressor::timerEvent(QTimerEvent *event)
+{
+    if(event->timerId() == timer_id_){
+        collect();
+    }
+}
+
+void LayerCompressor::collect()
+{
+    QList<LayerPointer> candidates;
+    qint64 resident = 0;
+    for(int i=0;i<layers_->count();++i){
+        LayerPointer l = layers_->layerFrom(i);
+        resident += l->residentBytes();
+        if(!l->isTouched() || l->isPacked() || l->isSelected()
+                || pending_.contains(l.data())){
+            continue;
+        }
+        candidates.append(l);
+    }
+    std::sort(candidates.begin(), candidates.end(),
+              [](const LayerPointer &a, const LayerPointer &b){
+        return a->lastAccess() < b->lastAccess();
+    });
+
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    for(const LayerPointer &l: candidates){
+        bool idle = now - l->lastWrite() > idle_timeout_;
+        bool hidden = l->isHided() && now - l->lastAccess() > hidden_timeout_;
+        if(idle || hidden || resident > memory_budget_){
+            resident -= l->residentBytes();
+            pack(l);
+        }
+    }
+}
+
+void LayerCompressor::pack(const LayerPointer &layer)
+{
+    // still packed from last time, and not written since
+    if(layer->release()){
+        return;
+    }
+
+    Layer *key = layer.data();
+    QWeakPointer<Layer> weak(layer);
+    quint64 generation = layer->generation();
+    pending_.insert(key);
+
+    auto watcher = new QFutureWatcher<QVector<QByteArray> >(this);
+    connect(watcher, &QFutureWatcher<QVector<QByteArray> >::finished,
+            [this, watcher, weak, key, generation](){
+        pending_.remove(key);
+        LayerPointer l = weak.toStrongRef();
+        if(l){
+            l->adoptPacked(generation, watcher->result());
+        }
+        watcher->deleteLater();
+    });
+    watcher->setFuture(QtConcurrent::run(&Layer::packTiles,
+                                         layer->snapshot()));
+}
@@ -0,0 +1,34 @@
+#ifndef LAYERCOMPRESSOR_H
+#define LAYERCOMPRESSOR_H
+
+#include <QObject>
+#include <QSet>
+#include "layer.h"
+
+class LayerManager;
+
+class LayerCompressor : public QObject
+{
+    Q_OBJECT
+public:
+    explicit LayerCompressor(LayerManager *layers, QObject *parent = nullptr);
+    ~LayerCompressor();
+    void setMemoryBudget(qint64 bytes);
+    void setIdleTimeout(int msecs);
+    void setHiddenTimeout(int msecs);
+    qint64 residentBytes() const;
+public slots:
+    void collect();
+protected:
+    void timerEvent(QTimerEvent *event);
+private:
+    void pack(const LayerPointer &layer);
+    LayerManager *layers_;
+    QSet<Layer *> pending_;
+    qint64 memory_budget_;
+    int idle_timeout_;
+    int hidden_timeout_;
+    int timer_id_;
+};
+
+#endif // LAYERCOMPRESSOR_H
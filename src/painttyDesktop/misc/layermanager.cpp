@@ -1,4 +1,5 @@
 #include "layermanager.h"
+#include "tilecompositor.h"
 
 #include <QPixmap>
 #include <QPainter>
@@ -6,7 +7,8 @@
 
 LayerManager::LayerManager(const QSize &initSize)
     :lastSelected(0),
-      layerSize_(initSize)
+      layerSize_(initSize),
+      revision_(0)
 {
 }
 
@@ -82,6 +84,7 @@ void LayerManager::insertLayer(LayerPointer image, const QString &name, int pos)
 {
     layerLinks.insert(pos,name);
     layers.insert(name,image);
+    ++revision_;
     qDebug()<<"instert"<<name<<"at"<<pos;
 }
 
@@ -92,6 +95,7 @@ void LayerManager::appendLayer(LayerPointer image, const QString &name)
     }
     layerLinks.append(name);
     layers.insert(name,image);
+    ++revision_;
     qDebug()<<"append"<<name<<"at"<<(layerLinks.count()-1);
 }
 
@@ -104,6 +108,7 @@ LayerPointer LayerManager::appendLayer(const QString &name)
     layerLinks.append(name);
     LayerPointer lp(new Layer(name, layerSize_));
     layers.insert(name, lp);
+    ++revision_;
     qDebug()<<"append"<<name<<"at"<<(layerLinks.count()-1);
     return lp;
 }
@@ -117,6 +122,7 @@ void LayerManager::removeLayer(const QString &name)
     }
     layers.remove(name);
     layerLinks.removeAll(name);
+    ++revision_;
     qDebug()<<"remove"<<name;
 }
 
@@ -172,6 +178,7 @@ void LayerManager::rename(const QString &oname,const QString &nname)
         layers[oname] = LayerPointer();
         int i = layerLinks.indexOf(oname);
         layerLinks[i] = nname;
+        ++revision_;
     }
 }
 
@@ -184,23 +191,20 @@ void LayerManager::resizeLayers(const QSize &newsize)
     qDebug()<<"LayerManager::resizeLayers:"<<layerSize_;
 }
 
-void LayerManager::combineLayers(QImage *p, const QRect &rect)
+void LayerManager::combineLayers(QImage *p, const QRect &rect,
+                                 bool visibleOnly)
 {
-    *p = p->scaled(layerSize_);
-    p->fill(Qt::white);
-    QPainter painter(p);
+    if(p->size() != layerSize_){
+        *p = QImage(layerSize_, QImage::Format_ARGB32_Premultiplied);
+    }
+    QList<LayerPointer> stack;
     int lc = this->count();
-    QImage * im = 0;
     for(int i=0;i<lc;++i){
         LayerPointer l = layerFrom(i);
-        if( l->isHided() || !l->isTouched() ){
+        if( (visibleOnly && l->isHided()) || !l->isTouched() ){
             continue;
         }
-        im = l->imagePtr();
-        if(rect.isNull()){
-            painter.drawImage(0, 0, *im);
-        }else{
-            painter.drawImage(QRectF(rect), *im, QRectF(rect));
-        }
+        stack.append(l);
     }
+    TileCompositor::composite(p, stack, rect);
 }
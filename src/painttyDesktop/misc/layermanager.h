@@ -36,9 +36,12 @@ public:
     bool exists(int pos) const;
     void rename(const QString &oname, const QString &nname);
     int count() const{return layers.count();}
+    // changes whenever a layer is added, removed or renamed
+    int revision() const{return revision_;}
     void resizeLayers(const QSize &newsize);
     void updateSelected();
-    void combineLayers(QImage *p, const QRect &rect = QRect());
+    void combineLayers(QImage *p, const QRect &rect = QRect(),
+                       bool visibleOnly = true);
 
 private:
     Q_DISABLE_COPY(LayerManager)
@@ -48,6 +51,7 @@ private:
     QHash<QString, LayerPointer> layers;
     LayerPointer lastSelected;
     QSize layerSize_;
+    int revision_;
 
 };
 
@@ -0,0 +1,296 @@
+#include "layerstore.h"
+#include "layermanager.h"
+
+#include <QImage>
+#include <QImageWriter>
+#include <QImageReader>
+#include <QSaveFile>
+#include <QFile>
+#include <QDir>
+#include <QFutureWatcher>
+#include <QtConcurrent>
+#include <QDebug>
+
+/*!
+    \class LayerStore
+
+    \brief Writes layers to the room cache in the background.
+
+    save() only writes the layers that changed since they were last
+    written, judged by Layer::generation(). Every layer is encoded by
+    its own task on the global thread pool, from a shallow copy of its
+    pixels, so painting can go on meanwhile. A packed layer stays
+    packed: the task gets its packed tiles and decodes them itself.
+
+    PNG is written with the fastest zlib level, and through QSaveFile,
+    so a file on disk is always either the old or the new layer.
+    While a file is being written, a newer request for it is queued
+    and issued when the write finishes. waitForDone() finishes the
+    writes in flight and then writes what was queued behind them
+    right away, as there may be no event loop left to issue them.
+
+    load() decodes all cached layers at once on the thread pool, and
+    hands each image to Layer::adopt() as it is ready, without any
+    further copy.
+*/
+
+LayerStore::LayerStore(QObject *parent)
+    :QObject(parent),
+      load_epoch_(0)
+{
+}
+
+LayerStore::~LayerStore()
+{
+    // the next room may read these files soon
+    waitForDone();
+}
+
+void LayerStore::save(const LayerManager &layers, const QString &dirName)
+{
+    QDir::current().mkpath(dirName);
+
+    for(int i=layers.count()-1;i>=0;--i){
+        QString img_name = QString("%1/%2.png").arg(dirName).arg(i);
+        saveLayer(layers.layerFrom(i), img_name, false);
+    }
+}
+
+// writes layer to fileName if the file does not hold it yet, in the
+// background unless wait is set
+void LayerStore::saveLayer(const LayerPointer &layer, const QString &fileName,
+                           bool wait)
+{
+    if(writing_.contains(fileName)){
+        stale_.insert(fileName, layer);
+        return;
+    }
+    if(!layer->isTouched()){
+        // a cleared layer must not come back next time
+        if(saved_.contains(fileName) || QFile::exists(fileName)){
+            QFile::remove(fileName);
+            saved_.remove(fileName);
+        }
+        return;
+    }
+    const Checkpoint &cp = saved_.value(fileName);
+    if(cp.layer.toStrongRef() == layer && cp.generation == layer->generation()){
+        return;
+    }
+    if(wait){
+        Checkpoint current;
+        current.layer = layer;
+        current.generation = layer->generation();
+        written(fileName, current,
+                writeLayer(layer->snapshot(), layer->packedTiles(),
+                           layer->size(), fileName));
+    }else{
+        write(layer, fileName);
+    }
+}
+
+/*!
+    \fn void LayerStore::load(const LayerManager &layers, const QString &dirName, const LayerPointer &first)
+
+    Decodes the cached layers in \a dirName concurrently. Only \a first,
+    usually the selected layer, is waited for; the others are adopted
+    from the event loop as they finish, and layerLoaded() is emitted
+    for each.
+*/
+
+void LayerStore::load(const LayerManager &layers, const QString &dirName,
+                      const LayerPointer &first)
+{
+    QList<LayerPointer> order;
+    if(first){
+        order.append(first);
+    }
+    for(int i=layers.count()-1;i>=0;--i){
+        if(layers.layerFrom(i) != first){
+            order.append(layers.layerFrom(i));
+        }
+    }
+
+    for(const LayerPointer &l: order){
+        int i = 0;
+        while(layers.layerFrom(i) != l){
+            ++i;
+        }
+        QString img_name = QString("%1/%2.png").arg(dirName).arg(i);
+        if(!QFile::exists(img_name)){
+            continue;
+        }
+        // tasks start in the order they are queued, first goes first
+        QFuture<QImage> future = QtConcurrent::run(&LayerStore::readImage,
+                                                   img_name);
+        if(l == first){
+            adopt(l, img_name, future.result());
+            continue;
+        }
+        QWeakPointer<Layer> weak(l);
+        int epoch = load_epoch_;
+        auto watcher = new QFutureWatcher<QImage>(this);
+        connect(watcher, &QFutureWatcher<QImage>::finished,
+                [this, watcher, weak, img_name, epoch](){
+            LayerPointer layer = weak.toStrongRef();
+            if(layer && epoch == load_epoch_){
+                adopt(layer, img_name, watcher->result());
+            }
+            watcher->deleteLater();
+        });
+        watcher->setFuture(future);
+    }
+}
+
+/*!
+    \fn void LayerStore::cancelLoading()
+
+    Drops the layers still being loaded, for example because the
+    canvas was cleared and the cached contents are outdated.
+*/
+
+void LayerStore::cancelLoading()
+{
+    ++load_epoch_;
+}
+
+void LayerStore::adopt(const LayerPointer &layer, const QString &fileName,
+                       const QImage &image)
+{
+    if(image.isNull()){
+        return;
+    }
+    // the file is only in sync if nothing was painted before it arrived
+    if(layer->adopt(image)){
+        markSaved(layer, fileName);
+    }
+    emit layerLoaded(fileName);
+}
+
+/*!
+    \fn void LayerStore::markSaved(const LayerPointer &layer, const QString &fileName)
+
+    Records that \a fileName holds the current contents of \a layer,
+    for example right after the layer was loaded from it.
+*/
+
+void LayerStore::markSaved(const LayerPointer &layer, const QString &fileName)
+{
+    Checkpoint cp;
+    cp.layer = layer;
+    cp.generation = layer->generation();
+    saved_.insert(fileName, cp);
+}
+
+/*!
+    \fn void LayerStore::waitForDone()
+
+    Blocks until every write in flight is finished, then writes the
+    layers that changed while they were written.
+*/
+
+void LayerStore::waitForDone()
+{
+    while(!writing_.isEmpty()){
+        auto it = writing_.begin();
+        const QString fileName = it.key();
+        Write w = it.value();
+        writing_.erase(it);
+        w.future.waitForFinished();
+        written(fileName, w.checkpoint, w.future.result());
+    }
+    const QHash<QString, LayerPointer> stale = stale_;
+    stale_.clear();
+    for(auto it = stale.constBegin(); it != stale.constEnd(); ++it){
+        saveLayer(it.value(), it.key(), true);
+    }
+}
+
+void LayerStore::write(const LayerPointer &layer, const QString &fileName)
+{
+    Write w;
+    w.checkpoint.layer = layer;
+    w.checkpoint.generation = layer->generation();
+    w.future = QtConcurrent::run(&LayerStore::writeLayer, layer->snapshot(),
+                                 layer->packedTiles(), layer->size(),
+                                 fileName);
+    writing_.insert(fileName, w);
+
+    auto watcher = new QFutureWatcher<bool>(this);
+    connect(watcher, &QFutureWatcher<bool>::finished,
+            [this, watcher, fileName](){
+        watcher->deleteLater();
+        // waitForDone() may have taken care of it already
+        auto it = writing_.find(fileName);
+        if(it == writing_.end() || it.value().future != watcher->future()){
+            return;
+        }
+        const Checkpoint cp = it.value().checkpoint;
+        writing_.erase(it);
+        written(fileName, cp, watcher->result());
+        LayerPointer stale = stale_.take(fileName);
+        if(stale){
+            saveLayer(stale, fileName, false);
+        }
+    });
+    watcher->setFuture(w.future);
+}
+
+void LayerStore::written(const QString &fileName, const Checkpoint &cp,
+                         bool ok)
+{
+    if(ok){
+        saved_.insert(fileName, cp);
+        emit layerSaved(fileName);
+    }else{
+        saved_.remove(fileName);
+        qWarning()<<"Cannot save layer to"<<fileName;
+    }
+}
+
+/*!
+    \fn bool LayerStore::writeLayer(const QImage &image,
+                                    const QVector<QByteArray> &tiles,
+                                    const QSize &size,
+                                    const QString &fileName)
+
+    Writes the pixels of a layer to \a fileName: \a image if the layer
+    is resident, otherwise its packed \a tiles, decoded to \a size here.
+*/
+
+bool LayerStore::writeLayer(const QImage &image,
+                            const QVector<QByteArray> &tiles,
+                            const QSize &size, const QString &fileName)
+{
+    if(!image.isNull()){
+        return writeImage(image, fileName);
+    }
+    return writeImage(Layer::unpackTiles(tiles, size), fileName);
+}
+
+QImage LayerStore::readImage(const QString &fileName)
+{
+    QImageReader reader(fileName, "png");
+    QImage image = reader.read();
+    if(image.isNull()){
+        return image;
+    }
+    // convert here, so the GUI thread can take the pixels as they are
+    return image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+}
+
+bool LayerStore::writeImage(const QImage &image, const QString &fileName)
+{
+    QSaveFile file(fileName);
+    if(!file.open(QIODevice::WriteOnly)){
+        return false;
+    }
+    QImageWriter writer(&file, "png");
+    // for png, quality 80 maps to zlib level 1, the fastest that compresses
+    writer.setQuality(80);
+    if(!writer.write(image)){
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit();
+}
@@ -0,0 +1,57 @@
+#ifndef LAYERSTORE_H
+#define LAYERSTORE_H
+
+#include <QObject>
+#include <QHash>
+#include <QFuture>
+#include "layer.h"
+
+class LayerManager;
+
+class LayerStore : public QObject
+{
+    Q_OBJECT
+public:
+    explicit LayerStore(QObject *parent = nullptr);
+    ~LayerStore();
+    void save(const LayerManager &layers, const QString &dirName);
+    void load(const LayerManager &layers, const QString &dirName,
+              const LayerPointer &first);
+    void cancelLoading();
+    void markSaved(const LayerPointer &layer, const QString &fileName);
+    void waitForDone();
+    static bool writeImage(const QImage &image, const QString &fileName);
+    static bool writeLayer(const QImage &image,
+                           const QVector<QByteArray> &tiles,
+                           const QSize &size, const QString &fileName);
+    static QImage readImage(const QString &fileName);
+signals:
+    void layerSaved(const QString &fileName);
+    void layerLoaded(const QString &fileName);
+private:
+    struct Checkpoint
+    {
+        Checkpoint():generation(0){}
+        QWeakPointer<Layer> layer;
+        quint64 generation;
+    };
+    struct Write
+    {
+        QFuture<bool> future;
+        Checkpoint checkpoint;
+    };
+    void saveLayer(const LayerPointer &layer, const QString &fileName,
+                   bool wait);
+    void write(const LayerPointer &layer, const QString &fileName);
+    void written(const QString &fileName, const Checkpoint &cp, bool ok);
+    void adopt(const LayerPointer &layer, const QString &fileName,
+               const QImage &image);
+    // what each file holds on disk, and what is being written to it
+    QHash<QString, Checkpoint> saved_;
+    QHash<QString, Write> writing_;
+    // layers to write again once the write in flight is done
+    QHash<QString, LayerPointer> stale_;
+    int load_epoch_;
+};
+
+#endif // LAYERSTORE_H
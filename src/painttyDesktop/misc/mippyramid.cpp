@@ -0,0 +1,144 @@
+#include "mippyramid.h"
+#include "tilecompositor.h"
+
+#include <QtConcurrent>
+#include <qmath.h>
+
+/*!
+    \class MipPyramid
+
+    \brief Keeps downsampled copies of the canvas composite.
+
+    Level 0 is the composite itself and is owned by the caller. Each
+    further level halves both sides of the previous one with a 2x2 box
+    filter. invalidate() marks an area of the composite as changed,
+    and a level is brought up to date only for that area, and only
+    when level() asks for it. Zoomed-out views then draw from a level
+    close to their scale, instead of resampling the full composite.
+*/
+
+MipPyramid::MipPyramid()
+{
+}
+
+void MipPyramid::reset(const QSize &size)
+{
+    size_ = size;
+    levels_.clear();
+    dirty_.clear();
+    QSize s = size;
+    for(int i=1;i<MAX_LEVELS;++i){
+        s = QSize((s.width() + 1) / 2, (s.height() + 1) / 2);
+        QImage image(s, QImage::Format_ARGB32_Premultiplied);
+        image.fill(Qt::transparent);
+        levels_.append(image);
+        dirty_.append(QRegion(QRect(QPoint(0, 0), size)));
+    }
+}
+
+void MipPyramid::invalidate(const QRect &rect)
+{
+    for(QRegion &r: dirty_){
+        r |= rect;
+    }
+}
+
+const QImage &MipPyramid::level(int index, const QImage &base)
+{
+    Q_ASSERT(index > 0 && index < MAX_LEVELS);
+    for(int i=1;i<=index;++i){
+        update(i, base);
+    }
+    return levels_[index - 1];
+}
+
+int MipPyramid::levelCount() const
+{
+    return levels_.count() + 1;
+}
+
+/*!
+    \fn int MipPyramid::levelFor(qreal scale)
+
+    Returns the smallest level that is still no smaller than the
+    screen at \a scale, so the view never magnifies a level.
+*/
+
+int MipPyramid::levelFor(qreal scale)
+{
+    if(scale <= 0 || scale > 0.5){
+        return 0;
+    }
+    return qMin(int(qFloor(qLn(1.0 / scale) / qLn(2.0) + 0.001)),
+                int(MAX_LEVELS) - 1);
+}
+
+void MipPyramid::update(int index, const QImage &base)
+{
+    QRegion &dirty = dirty_[index - 1];
+    if(dirty.isEmpty()){
+        return;
+    }
+    const QImage &src = index == 1 ? base : levels_[index - 2];
+    QImage *dest = &levels_[index - 1];
+    const QRect bounds = dest->rect();
+    QVector<QRect> rects;
+    for(const QRect &r: dirty.rects()){
+        // base coordinates to this level, rounded outwards
+        rects += TileCompositor::tilesOf(
+                    QRect(QPoint(r.left() >> index, r.top() >> index),
+                          QPoint(r.right() >> index, r.bottom() >> index))
+                    .intersected(bounds));
+    }
+    dirty = QRegion();
+
+    // NOTICE: detach before the workers write into dest
+    dest->bits();
+    auto downsampleTile = [&](const QRect &rect){
+        downsample(src, dest, rect);
+    };
+    qint64 area = 0;
+    for(const QRect &r: rects){
+        area += qint64(r.width()) * r.height();
+    }
+    if(area < TileCompositor::PARALLEL_THRESHOLD / 4){
+        for(const QRect &r: rects){
+            downsampleTile(r);
+        }
+    }else{
+        QtConcurrent::blockingMap(rects, downsampleTile);
+    }
+}
+
+/*!
+    \fn void MipPyramid::downsample(const QImage &src, QImage *dest, const QRect &rect)
+
+    Fills \a rect of \a dest, which is half the size of \a src, with
+    the average of each 2x2 block of \a src. Both must be 32bpp
+    premultiplied, so averaging channels directly is exact.
+*/
+
+void MipPyramid::downsample(const QImage &src, QImage *dest, const QRect &rect)
+{
+    const int sw = src.width();
+    const int sh = src.height();
+    for(int y = rect.top(); y <= rect.bottom(); ++y){
+        const quint32 *row0 = reinterpret_cast<const quint32 *>(
+                    src.constScanLine(qMin(y * 2, sh - 1)));
+        const quint32 *row1 = reinterpret_cast<const quint32 *>(
+                    src.constScanLine(qMin(y * 2 + 1, sh - 1)));
+        quint32 *out = reinterpret_cast<quint32 *>(dest->scanLine(y));
+        for(int x = rect.left(); x <= rect.right(); ++x){
+            const int x0 = qMin(x * 2, sw - 1);
+            const int x1 = qMin(x * 2 + 1, sw - 1);
+            const quint32 a = row0[x0], b = row0[x1];
+            const quint32 c = row1[x0], d = row1[x1];
+            // two channels per 32bit lane, the sum of four fits in 10 bits
+            const quint32 rb = (a & 0xff00ff) + (b & 0xff00ff)
+                    + (c & 0xff00ff) + (d & 0xff00ff) + 0x20002;
+            const quint32 ag = ((a >> 8) & 0xff00ff) + ((b >> 8) & 0xff00ff)
+                    + ((c >> 8) & 0xff00ff) + ((d >> 8) & 0xff00ff) + 0x20002;
+            out[x] = ((rb >> 2) & 0xff00ff) | (((ag >> 2) & 0xff00ff) << 8);
+        }
+    }
+}
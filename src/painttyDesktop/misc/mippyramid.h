@@ -0,0 +1,33 @@
+#ifndef MIPPYRAMID_H
+#define MIPPYRAMID_H
+
+#include <QImage>
+#include <QVector>
+#include <QRegion>
+
+class MipPyramid
+{
+public:
+    enum : int {
+        // level 3 is 1/8, which covers MIN_SCALE_FACTOR
+        MAX_LEVELS = 4
+    };
+
+    MipPyramid();
+    void reset(const QSize &size);
+    void invalidate(const QRect &rect);
+    const QImage &level(int index, const QImage &base);
+    int levelCount() const;
+    static int levelFor(qreal scale);
+    static void downsample(const QImage &src, QImage *dest, const QRect &rect);
+
+private:
+    void update(int index, const QImage &base);
+    // levels_[i] is level i+1, half the size of level i
+    QVector<QImage> levels_;
+    // base coordinates not yet propagated to each level
+    QVector<QRegion> dirty_;
+    QSize size_;
+};
+
+#endif // MIPPYRAMID_H
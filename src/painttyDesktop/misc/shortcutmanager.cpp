@@ -39,7 +39,7 @@ ShortcutManager::ShortcutManager(QObject *parent) :
     map.insert("description", tr("Sketch"));
     default_conf.insert("sketchbrush", map);
 
-    // TODO
+    // no shortcut while WaterBased is not registered
 //    map.insert("name", "waterbrush");
 //    map.insert("key", QKeySequence("/"));
 //    map.insert("type", ShortcutType::Single);
@@ -100,6 +100,18 @@ ShortcutManager::ShortcutManager(QObject *parent) :
 //    map.insert("description", tr("Decrease brush hardness"));
 //    default_conf.insert("subhardness", map);
 
+    map.insert("name", "undo");
+    map.insert("key", QKeySequence("Ctrl+Z"));
+    map.insert("type", ShortcutType::Multiple);
+    map.insert("description", tr("Undo last stroke"));
+    default_conf.insert("undo", map);
+
+    map.insert("name", "redo");
+    map.insert("key", QKeySequence("Ctrl+Y"));
+    map.insert("type", ShortcutType::Multiple);
+    map.insert("description", tr("Redo last undone stroke"));
+    default_conf.insert("redo", map);
+
     map.insert("name", "zoomin");
     map.insert("key", QKeySequence("="));
     map.insert("type", ShortcutType::Multiple);
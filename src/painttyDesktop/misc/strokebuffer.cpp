@@ -0,0 +1,60 @@
+#include "strokebuffer.h"
+
+/*!
+    \class StrokeBuffer
+
+    \brief Holds the points of one local stroke.
+
+    Points are kept as plain arrays of x, y, pressure and timestamp,
+    preallocated to a capacity and reused across strokes, so recording
+    a point never touches the heap unless a stroke outgrows the
+    capacity, which then doubles.
+
+    The arrays are implicitly shared. Handing a buffer to another
+    thread costs a reference count, and once the receiver drops its
+    copy, the next stroke writes in place again.
+*/
+
+StrokeBuffer::StrokeBuffer(int capacity)
+    :x_(qMax(1, capacity)),
+      y_(qMax(1, capacity)),
+      pressure_(qMax(1, capacity)),
+      timestamp_(qMax(1, capacity)),
+      count_(0)
+{
+}
+
+void StrokeBuffer::append(const QPoint &point, qreal pressure)
+{
+    if(count_ == 0){
+        clock_.start();
+    }
+    if(count_ == x_.size()){
+        grow();
+    }
+    x_.data()[count_] = point.x();
+    y_.data()[count_] = point.y();
+    pressure_.data()[count_] = pressure;
+    timestamp_.data()[count_] = count_ ? quint32(clock_.elapsed()) : 0;
+    ++count_;
+}
+
+/*!
+    \fn void StrokeBuffer::clear()
+
+    Forgets all points but keeps the storage for the next stroke.
+*/
+
+void StrokeBuffer::clear()
+{
+    count_ = 0;
+}
+
+void StrokeBuffer::grow()
+{
+    const int capacity = x_.size() * 2;
+    x_.resize(capacity);
+    y_.resize(capacity);
+    pressure_.resize(capacity);
+    timestamp_.resize(capacity);
+}
@@ -0,0 +1,41 @@
+#ifndef STROKEBUFFER_H
+#define STROKEBUFFER_H
+
+#include <QVector>
+#include <QPoint>
+#include <QElapsedTimer>
+#include <QMetaType>
+
+class StrokeBuffer
+{
+public:
+    explicit StrokeBuffer(int capacity = 1024);
+
+    void append(const QPoint &point, qreal pressure);
+    void clear();
+    int count() const {return count_;}
+    bool isEmpty() const {return count_ == 0;}
+
+    int x(int i) const {return x_[i];}
+    int y(int i) const {return y_[i];}
+    QPoint point(int i) const {return QPoint(x_[i], y_[i]);}
+    qreal pressure(int i) const {return pressure_[i];}
+    // milliseconds since the first point of the stroke
+    quint32 timestamp(int i) const {return timestamp_[i];}
+
+private:
+    void grow();
+
+    // struct of arrays, sized to the capacity and never shrunk,
+    // count_ tells how much of them is used
+    QVector<qint32> x_;
+    QVector<qint32> y_;
+    QVector<qreal> pressure_;
+    QVector<quint32> timestamp_;
+    int count_;
+    QElapsedTimer clock_;
+};
+
+Q_DECLARE_METATYPE(StrokeBuffer)
+
+#endif // STROKEBUFFER_H
@@ -0,0 +1,374 @@
+#include "strokehistory.h"
+#include "layermanager.h"
+#include "tilecodec.h"
+
+#include <QPainter>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QDataStream>
+#include <QDebug>
+
+/*!
+    \class StrokeHistory
+
+    \brief Keeps local undo and redo steps as tile deltas.
+
+    While a stroke is recorded, capture() is called with the area the
+    brush is about to touch, and the before-image of every tile in it is
+    copied once. On commit() these tiles are compressed with the tile
+    codec, so a step costs memory in proportion to the tiles the stroke
+    touched, not to the canvas size. The tiles as the stroke left them
+    are kept as well: undo and redo only write pixels that still look
+    the way the step left them, and leave those painted over since,
+    usually by other members of the room, as they are.
+
+    Steps live in a ring bounded by a step count and a memory budget.
+    Once the budget is exceeded, the oldest steps are spilled to disk
+    and read back when they are undone.
+*/
+
+static inline quint32 tileKey(int tx, int ty)
+{
+    return (quint32(ty) << 16) | quint32(tx);
+}
+
+QRect StrokeHistory::Step::boundingRect() const
+{
+    QRect rect;
+    for(const QPoint &pos: positions){
+        rect |= QRect(pos, QSize(TILE_SIZE, TILE_SIZE));
+    }
+    return rect;
+}
+
+StrokeHistory::StrokeHistory(qint64 memoryBudget, int maxSteps)
+    :memoryBudget_(memoryBudget),
+      maxSteps_(maxSteps),
+      memoryUsage_(0),
+      spillCounter_(0)
+{
+}
+
+StrokeHistory::~StrokeHistory()
+{
+    clear();
+}
+
+void StrokeHistory::begin(const LayerPointer &layer)
+{
+    if(recording_){
+        commit();
+    }
+    recording_ = layer;
+    pending_.clear();
+}
+
+void StrokeHistory::capture(const QRect &rect)
+{
+    if(!recording_){
+        return;
+    }
+    const QImage *image = recording_->imageConstPtr();
+    const QRect area = rect.intersected(image->rect());
+    if(area.isEmpty()){
+        return;
+    }
+    for(int ty = area.top() / TILE_SIZE; ty <= area.bottom() / TILE_SIZE; ++ty){
+        for(int tx = area.left() / TILE_SIZE; tx <= area.right() / TILE_SIZE; ++tx){
+            const quint32 key = tileKey(tx, ty);
+            if(pending_.contains(key)){
+                continue;
+            }
+            QRect tile(tx * TILE_SIZE, ty * TILE_SIZE, TILE_SIZE, TILE_SIZE);
+            pending_.insert(key, image->copy(tile.intersected(image->rect())));
+        }
+    }
+}
+
+void StrokeHistory::commit()
+{
+    if(!recording_ || pending_.isEmpty()){
+        recording_.clear();
+        pending_.clear();
+        return;
+    }
+    Step step;
+    step.layer = recording_->name();
+    const QImage *image = recording_->imageConstPtr();
+    for(auto it = pending_.constBegin(); it != pending_.constEnd(); ++it){
+        const quint32 key = it.key();
+        const QPoint pos((key & 0xffff) * TILE_SIZE, (key >> 16) * TILE_SIZE);
+        step.positions.append(pos);
+        QByteArray data = encodeTile(it.value());
+        QByteArray after = encodeTile(image->copy(QRect(pos, it.value().size())));
+        step.bytes += data.size() + after.size();
+        step.tiles.append(data);
+        step.expected.append(after);
+    }
+    memoryUsage_ += step.bytes;
+    undo_.append(step);
+    recording_.clear();
+    pending_.clear();
+
+    // a new stroke makes redo steps meaningless
+    for(Step &s: redo_){
+        drop(s);
+    }
+    redo_.clear();
+    enforceBudget();
+}
+
+bool StrokeHistory::isRecording() const
+{
+    return !recording_.isNull();
+}
+
+bool StrokeHistory::canUndo() const
+{
+    return !undo_.isEmpty();
+}
+
+bool StrokeHistory::canRedo() const
+{
+    return !redo_.isEmpty();
+}
+
+StrokeHistory::Step StrokeHistory::undo(const LayerManager &layers)
+{
+    if(undo_.isEmpty()){
+        return Step();
+    }
+    Step step = undo_.takeLast();
+    Step applied;
+    if(!swap(step, layers, &applied)){
+        drop(step);
+        return Step();
+    }
+    redo_.append(step);
+    enforceBudget();
+    return applied;
+}
+
+StrokeHistory::Step StrokeHistory::redo(const LayerManager &layers)
+{
+    if(redo_.isEmpty()){
+        return Step();
+    }
+    Step step = redo_.takeLast();
+    Step applied;
+    if(!swap(step, layers, &applied)){
+        drop(step);
+        return Step();
+    }
+    undo_.append(step);
+    enforceBudget();
+    return applied;
+}
+
+void StrokeHistory::clear()
+{
+    for(Step &s: undo_){
+        drop(s);
+    }
+    for(Step &s: redo_){
+        drop(s);
+    }
+    undo_.clear();
+    redo_.clear();
+    recording_.clear();
+    pending_.clear();
+    memoryUsage_ = 0;
+
+    QDir dir(spillDir());
+    if(dir.exists()){
+        dir.removeRecursively();
+    }
+}
+
+void StrokeHistory::setMemoryBudget(qint64 bytes)
+{
+    memoryBudget_ = bytes;
+    enforceBudget();
+}
+
+void StrokeHistory::setMaxSteps(int steps)
+{
+    maxSteps_ = qMax(1, steps);
+    enforceBudget();
+}
+
+qint64 StrokeHistory::memoryUsage() const
+{
+    return memoryUsage_;
+}
+
+/*!
+    \fn void StrokeHistory::restoreTile(QImage *image, const QPoint &pos,
+                                        const QImage &tile,
+                                        const QImage &expected)
+
+    Writes \a tile into \a image at \a pos, but only the pixels that
+    \a image holds as in \a expected. Pixels changed since are kept.
+    If \a expected is null, or of another size, the whole tile is
+    written, as restores from older clients expect.
+*/
+
+void StrokeHistory::restoreTile(QImage *image, const QPoint &pos,
+                                const QImage &tile, const QImage &expected)
+{
+    if(expected.isNull() || expected.size() != tile.size()){
+        QPainter painter(image);
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+        painter.drawImage(pos, tile);
+        painter.end();
+        return;
+    }
+    const QRect rect = QRect(pos, tile.size()).intersected(image->rect());
+    if(rect.isEmpty()){
+        return;
+    }
+    const QImage source = tile.convertToFormat(image->format());
+    const QImage match = expected.convertToFormat(image->format());
+    const int sx = rect.x() - pos.x();
+    for(int y = rect.top(); y <= rect.bottom(); ++y){
+        quint32 *dest = reinterpret_cast<quint32 *>(image->scanLine(y)) + rect.x();
+        const quint32 *src = reinterpret_cast<const quint32 *>(
+                    source.constScanLine(y - pos.y())) + sx;
+        const quint32 *exp = reinterpret_cast<const quint32 *>(
+                    match.constScanLine(y - pos.y())) + sx;
+        for(int x = 0; x < rect.width(); ++x){
+            if(dest[x] == exp[x]){
+                dest[x] = src[x];
+            }
+        }
+    }
+}
+
+// Writes the tiles of step into the layer where it still holds what
+// the step expects, and keeps what they replaced in step, for the
+// opposite direction.
+bool StrokeHistory::swap(Step &step, const LayerManager &layers, Step *applied)
+{
+    LayerPointer layer = layers.layerFrom(step.layer);
+    if(layer.isNull() || !unspill(step)){
+        return false;
+    }
+    *applied = step;
+    applied->spillFile.clear();
+
+    QImage *image = layer->imagePtr();
+    qint64 bytes = 0;
+    for(int i = 0; i < step.tiles.count(); ++i){
+        const QImage tile = decodeTile(step.tiles[i]);
+        if(tile.isNull()){
+            qWarning()<<"Broken undo tile skipped";
+            bytes += step.tiles[i].size() + step.expected[i].size();
+            continue;
+        }
+        const QRect rect(step.positions[i], tile.size());
+        step.tiles[i] = encodeTile(image->copy(rect));
+        restoreTile(image, step.positions[i], tile,
+                    decodeTile(step.expected[i]));
+        // pixels that were kept hold the same on both sides,
+        // so the opposite direction leaves them alone as well
+        step.expected[i] = encodeTile(image->copy(rect));
+        bytes += step.tiles[i].size() + step.expected[i].size();
+    }
+    layer->markModified();
+
+    memoryUsage_ += bytes - step.bytes;
+    step.bytes = bytes;
+    return true;
+}
+
+void StrokeHistory::enforceBudget()
+{
+    // forget the oldest steps first
+    while(undo_.count() + redo_.count() > maxSteps_ && !undo_.isEmpty()){
+        drop(undo_.first());
+        undo_.removeFirst();
+    }
+    // then move the ones far from the present out of memory
+    for(int i = 0; i < undo_.count() && memoryUsage_ > memoryBudget_; ++i){
+        spill(undo_[i]);
+    }
+    for(int i = 0; i < redo_.count() && memoryUsage_ > memoryBudget_; ++i){
+        spill(redo_[i]);
+    }
+}
+
+bool StrokeHistory::spill(Step &step)
+{
+    if(!step.spillFile.isEmpty() || step.tiles.isEmpty()){
+        return true;
+    }
+    QDir::current().mkpath(spillDir());
+    QString name = QString("%1/%2.undo").arg(spillDir()).arg(spillCounter_++);
+    QFile file(name);
+    if(!file.open(QIODevice::WriteOnly|QIODevice::Truncate)){
+        qWarning()<<"Cannot spill undo step to"<<name;
+        return false;
+    }
+    QDataStream stream(&file);
+    stream << step.positions << step.tiles << step.expected;
+    file.close();
+    if(stream.status() != QDataStream::Ok){
+        file.remove();
+        return false;
+    }
+    memoryUsage_ -= step.bytes;
+    step.positions.clear();
+    step.tiles.clear();
+    step.expected.clear();
+    step.spillFile = name;
+    return true;
+}
+
+bool StrokeHistory::unspill(Step &step)
+{
+    if(step.spillFile.isEmpty()){
+        return true;
+    }
+    QFile file(step.spillFile);
+    if(!file.open(QIODevice::ReadOnly)){
+        qWarning()<<"Cannot read spilled undo step"<<step.spillFile;
+        return false;
+    }
+    QDataStream stream(&file);
+    stream >> step.positions >> step.tiles >> step.expected;
+    file.close();
+    file.remove();
+    step.spillFile.clear();
+    if(stream.status() != QDataStream::Ok
+            || step.positions.count() != step.tiles.count()
+            || step.expected.count() != step.tiles.count()){
+        step.positions.clear();
+        step.tiles.clear();
+        step.expected.clear();
+        step.bytes = 0;
+        return false;
+    }
+    memoryUsage_ += step.bytes;
+    return true;
+}
+
+void StrokeHistory::drop(Step &step)
+{
+    if(step.spillFile.isEmpty()){
+        memoryUsage_ -= step.bytes;
+    }else{
+        QFile::remove(step.spillFile);
+        step.spillFile.clear();
+    }
+    step.positions.clear();
+    step.tiles.clear();
+    step.expected.clear();
+    step.bytes = 0;
+}
+
+QString StrokeHistory::spillDir() const
+{
+    return QDir::temp().filePath(QString("mrpaint-undo-%1")
+                                 .arg(QCoreApplication::applicationPid()));
+}
@@ -0,0 +1,84 @@
+#ifndef STROKEHISTORY_H
+#define STROKEHISTORY_H
+
+#include <QList>
+#include <QVector>
+#include <QHash>
+#include <QImage>
+#include <QByteArray>
+#include <QString>
+#include <QRect>
+#include "layer.h"
+
+class LayerManager;
+
+class StrokeHistory
+{
+public:
+    enum : int {
+        TILE_SIZE = 64
+    };
+
+    // One undo step: encoded contents of the tiles a stroke touched.
+    // Before an undo they hold the state before the stroke,
+    // and after it they hold the state the undo replaced.
+    // expected holds what the step left in the same tiles; only pixels
+    // the layer still has as expected are restored, so strokes others
+    // drew over them since are kept.
+    struct Step
+    {
+        Step():bytes(0){}
+        QString layer;
+        QVector<QPoint> positions;
+        QVector<QByteArray> tiles;
+        QVector<QByteArray> expected;
+        qint64 bytes;
+        QString spillFile;
+        QRect boundingRect() const;
+    };
+
+    StrokeHistory(qint64 memoryBudget = 64*1024*1024,
+                  int maxSteps = 100);
+    ~StrokeHistory();
+
+    void begin(const LayerPointer &layer);
+    void capture(const QRect &rect);
+    void commit();
+    bool isRecording() const;
+
+    bool canUndo() const;
+    bool canRedo() const;
+    // Both return the step that was applied, with tiles holding
+    // the new contents of the layer. An empty step means nothing happened.
+    Step undo(const LayerManager &layers);
+    Step redo(const LayerManager &layers);
+    void clear();
+
+    void setMemoryBudget(qint64 bytes);
+    void setMaxSteps(int steps);
+    qint64 memoryUsage() const;
+
+    static void restoreTile(QImage *image, const QPoint &pos,
+                            const QImage &tile, const QImage &expected);
+
+private:
+    Q_DISABLE_COPY(StrokeHistory)
+    bool swap(Step &step, const LayerManager &layers, Step *applied);
+    void enforceBudget();
+    bool spill(Step &step);
+    bool unspill(Step &step);
+    void drop(Step &step);
+    QString spillDir() const;
+
+    QList<Step> undo_;
+    QList<Step> redo_;
+    LayerPointer recording_;
+    // tiles captured by the stroke being recorded, keyed by tile position
+    QHash<quint32, QImage> pending_;
+    qint64 memoryBudget_;
+    int maxSteps_;
+    qint64 memoryUsage_;
+    int spillCounter_;
+};
+
+#endif // STROKEHISTORY_H
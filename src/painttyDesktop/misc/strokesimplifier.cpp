@@ -0,0 +1,180 @@
+#include "strokesimplifier.h"
+
+#include <QtMath>
+
+/*!
+    \class StrokeSimplifier
+
+    \brief Drops stroke points that a straight line would cover anyway.
+
+    Points are pushed as they arrive. The simplifier keeps the last kept
+    point as an anchor and a window of at most window() points after it.
+    A new point is accepted into the window while every point in it lies
+    within tolerance() pixels of the segment from the anchor to the new
+    point, and its pressure is close to the one interpolated along that
+    segment. Otherwise the newest point of the window is kept and becomes
+    the new anchor.
+
+    Each push checks at most window() points, so a stroke is simplified
+    in linear time, and no kept line strays farther than tolerance()
+    from the points it replaces.
+*/
+
+// largest pressure error a dropped point may have
+static const qreal PRESSURE_TOLERANCE = 0.05;
+
+StrokeSimplifier::StrokeSimplifier(qreal tolerance, int window)
+    :tolerance_(0),
+      window_(1),
+      count_(0),
+      pushed_(0),
+      kept_(0)
+{
+    setTolerance(tolerance);
+    setWindow(window);
+    anchor_.pressure = 1.0;
+}
+
+void StrokeSimplifier::setTolerance(qreal pixels)
+{
+    tolerance_ = qMax<qreal>(0, pixels);
+}
+
+qreal StrokeSimplifier::tolerance() const
+{
+    return tolerance_;
+}
+
+void StrokeSimplifier::setWindow(int points)
+{
+    window_ = qBound(1, points, int(MAX_WINDOW));
+}
+
+int StrokeSimplifier::window() const
+{
+    return window_;
+}
+
+/*!
+    \fn void StrokeSimplifier::begin(const QPoint &pos, qreal pressure)
+
+    Starts a stroke at \a pos. The first point is always kept,
+    so it is not reported by push().
+*/
+
+void StrokeSimplifier::begin(const QPoint &pos, qreal pressure)
+{
+    anchor_.pos = pos;
+    anchor_.pressure = pressure;
+    count_ = 0;
+    ++pushed_;
+    ++kept_;
+}
+
+/*!
+    \fn bool StrokeSimplifier::push(const QPoint &pos, qreal pressure, Point *out)
+
+    Adds a point to the stroke. Returns true and stores in \a out a
+    point that must be drawn now, or returns false when the point is
+    still pending.
+*/
+
+bool StrokeSimplifier::push(const QPoint &pos, qreal pressure, Point *out)
+{
+    ++pushed_;
+    Point point;
+    point.pos = pos;
+    point.pressure = pressure;
+
+    if(fits(point)){
+        pending_[count_++] = point;
+        if(count_ < window_){
+            return false;
+        }
+        // window is full, keep the newest point
+        anchor_ = point;
+        count_ = 0;
+    }else{
+        anchor_ = pending_[count_ - 1];
+        pending_[0] = point;
+        count_ = 1;
+    }
+    *out = anchor_;
+    ++kept_;
+    return true;
+}
+
+/*!
+    \fn bool StrokeSimplifier::flush(Point *out)
+
+    Ends the stroke. Returns true and stores in \a out the last point,
+    if it is still pending.
+*/
+
+bool StrokeSimplifier::flush(Point *out)
+{
+    if(count_ == 0){
+        return false;
+    }
+    anchor_ = pending_[count_ - 1];
+    count_ = 0;
+    *out = anchor_;
+    ++kept_;
+    return true;
+}
+
+qint64 StrokeSimplifier::pushedCount() const
+{
+    return pushed_;
+}
+
+qint64 StrokeSimplifier::keptCount() const
+{
+    return kept_;
+}
+
+/*!
+    \fn qreal StrokeSimplifier::reduction() const
+
+    Returns the fraction of points dropped so far, from 0 to 1.
+*/
+
+qreal StrokeSimplifier::reduction() const
+{
+    if(pushed_ == 0){
+        return 0;
+    }
+    return 1.0 - qreal(kept_) / pushed_;
+}
+
+bool StrokeSimplifier::fits(const Point &end) const
+{
+    if(count_ == 0){
+        return true;
+    }
+    const qreal dx = end.pos.x() - anchor_.pos.x();
+    const qreal dy = end.pos.y() - anchor_.pos.y();
+    const qreal length2 = dx * dx + dy * dy;
+    const qreal tolerance2 = tolerance_ * tolerance_;
+
+    for(int i = 0; i < count_; ++i){
+        const qreal px = pending_[i].pos.x() - anchor_.pos.x();
+        const qreal py = pending_[i].pos.y() - anchor_.pos.y();
+        // position of the projection on the segment, from 0 to 1
+        qreal t = 0;
+        if(length2 > 0){
+            t = qBound<qreal>(0, (px * dx + py * dy) / length2, 1);
+        }
+        const qreal ex = px - t * dx;
+        const qreal ey = py - t * dy;
+        if(ex * ex + ey * ey > tolerance2){
+            return false;
+        }
+        const qreal pressure = anchor_.pressure
+                + t * (end.pressure - anchor_.pressure);
+        if(qAbs(pending_[i].pressure - pressure) > PRESSURE_TOLERANCE){
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,47 @@
+#ifndef STROKESIMPLIFIER_H
+#define STROKESIMPLIFIER_H
+
+#include <QPoint>
+
+class StrokeSimplifier
+{
+public:
+    enum : int {
+        MAX_WINDOW = 16
+    };
+
+    struct Point
+    {
+        QPoint pos;
+        qreal pressure;
+    };
+
+    explicit StrokeSimplifier(qreal tolerance = 2.5, int window = 10);
+
+    void setTolerance(qreal pixels);
+    qreal tolerance() const;
+    void setWindow(int points);
+    int window() const;
+
+    void begin(const QPoint &pos, qreal pressure);
+    bool push(const QPoint &pos, qreal pressure, Point *out);
+    bool flush(Point *out);
+
+    // points pushed and points kept, since construction
+    qint64 pushedCount() const;
+    qint64 keptCount() const;
+    qreal reduction() const;
+
+private:
+    bool fits(const Point &end) const;
+
+    qreal tolerance_;
+    int window_;
+    Point anchor_;
+    Point pending_[MAX_WINDOW];
+    int count_;
+    qint64 pushed_;
+    qint64 kept_;
+};
+
+#endif // STROKESIMPLIFIER_H
@@ -0,0 +1,119 @@
+#include "tilecodec.h"
+
+#include <QtEndian>
+
+// Layout, all little endian:
+//   quint16 width, quint16 height,
+//   then per row a sequence of runs, each starting with a quint16 control:
+//     high bit set:   repeat run, (control & 0x7fff) + 1 copies of one pixel
+//     high bit clear: literal run, control + 1 pixels follow
+
+static const int MAX_RUN = 0x8000;
+
+QByteArray encodeTile(const QImage &image)
+{
+    QImage src = image;
+    if(src.depth() != 32){
+        src = src.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    }
+    const int w = src.width();
+    const int h = src.height();
+    if(w <= 0 || h <= 0 || w > 0xffff || h > 0xffff){
+        return QByteArray();
+    }
+
+    // worst case is a lonely literal pixel before each repeat run
+    QByteArray out(4 + h * w * 6, Qt::Uninitialized);
+    uchar *dest = reinterpret_cast<uchar *>(out.data());
+    uchar *p = dest;
+    qToLittleEndian<quint16>(w, p);
+    qToLittleEndian<quint16>(h, p + 2);
+    p += 4;
+
+    for(int y = 0; y < h; ++y){
+        const quint32 *line = reinterpret_cast<const quint32 *>(src.constScanLine(y));
+        int x = 0;
+        while(x < w){
+            int run = 1;
+            while(x + run < w && run < MAX_RUN && line[x + run] == line[x]){
+                ++run;
+            }
+            if(run > 1){
+                qToLittleEndian<quint16>(0x8000 | (run - 1), p);
+                qToLittleEndian<quint32>(line[x], p + 2);
+                p += 6;
+                x += run;
+                continue;
+            }
+
+            const int start = x++;
+            while(x < w && x - start < MAX_RUN){
+                if(x + 1 < w && line[x] == line[x + 1]){
+                    break;
+                }
+                ++x;
+            }
+            const int count = x - start;
+            qToLittleEndian<quint16>(count - 1, p);
+            p += 2;
+            for(int i = 0; i < count; ++i){
+                qToLittleEndian<quint32>(line[start + i], p);
+                p += 4;
+            }
+        }
+    }
+
+    out.resize(p - dest);
+    return out;
+}
+
+QImage decodeTile(const QByteArray &data)
+{
+    if(data.size() < 4){
+        return QImage();
+    }
+    const uchar *p = reinterpret_cast<const uchar *>(data.constData());
+    const uchar *end = p + data.size();
+    const int w = qFromLittleEndian<quint16>(p);
+    const int h = qFromLittleEndian<quint16>(p + 2);
+    p += 4;
+    if(w <= 0 || h <= 0){
+        return QImage();
+    }
+
+    QImage image(w, h, QImage::Format_ARGB32_Premultiplied);
+    for(int y = 0; y < h; ++y){
+        quint32 *line = reinterpret_cast<quint32 *>(image.scanLine(y));
+        int x = 0;
+        while(x < w){
+            if(end - p < 2){
+                return QImage();
+            }
+            const quint16 control = qFromLittleEndian<quint16>(p);
+            p += 2;
+            const int count = (control & 0x7fff) + 1;
+            if(x + count > w){
+                return QImage();
+            }
+            if(control & 0x8000){
+                if(end - p < 4){
+                    return QImage();
+                }
+                const quint32 pixel = qFromLittleEndian<quint32>(p);
+                p += 4;
+                for(int i = 0; i < count; ++i){
+                    line[x++] = pixel;
+                }
+            }else{
+                if(end - p < count * 4){
+                    return QImage();
+                }
+                for(int i = 0; i < count; ++i){
+                    line[x++] = qFromLittleEndian<quint32>(p);
+                    p += 4;
+                }
+            }
+        }
+    }
+    return image;
+}
@@ -0,0 +1,13 @@
+#ifndef TILECODEC_H
+#define TILECODEC_H
+
+#include <QByteArray>
+#include <QImage>
+
+// A fast run-length codec for 32bpp image tiles.
+// Painting layers are mostly transparent or flat, which suits RLE well,
+// and both directions cost one linear pass over the pixels.
+QByteArray encodeTile(const QImage &image);
+QImage decodeTile(const QByteArray &data);
+
+#endif // TILECODEC_H
@@ -0,0 +1,81 @@
+#include "tilecompositor.h"
+
+#include <QImage>
+#include <QPainter>
+#include <QtConcurrent>
+
+/*!
+    \class TileCompositor
+
+    \brief Composites a stack of layers into a target image.
+
+    Small dirty areas, which are the usual case while painting, are
+    composited inline. Large ones, such as after a replay, a clear or
+    toggling a layer, are split into tiles of TILE_SIZE pixels and spread
+    over the global thread pool. Each worker writes into its own tile of
+    the target, so no locking is needed.
+
+    Layers are drawn with Layer::paint(), so packed layers are
+    decoded tile by tile instead of being unpacked as a whole.
+*/
+
+/*!
+    \fn QVector<QRect> TileCompositor::tilesOf(const QRect &rect)
+
+    Splits \a rect into tiles aligned to the TILE_SIZE grid.
+*/
+
+QVector<QRect> TileCompositor::tilesOf(const QRect &rect)
+{
+    QVector<QRect> tiles;
+    if(rect.isEmpty()){
+        return tiles;
+    }
+    const int left = rect.left() - rect.left() % TILE_SIZE;
+    const int top = rect.top() - rect.top() % TILE_SIZE;
+    for(int y = top; y <= rect.bottom(); y += TILE_SIZE){
+        for(int x = left; x <= rect.right(); x += TILE_SIZE){
+            tiles.append(QRect(x, y, TILE_SIZE, TILE_SIZE)
+                         .intersected(rect));
+        }
+    }
+    return tiles;
+}
+
+void TileCompositor::composite(QImage *target,
+                               const QList<LayerPointer> &layers,
+                               const QRect &rect,
+                               const QColor &background)
+{
+    const QRect area = rect.isNull() ? target->rect()
+                                     : rect.intersected(target->rect());
+    if(area.isEmpty()){
+        return;
+    }
+
+    // NOTICE: bits() detaches here, on the calling thread,
+    // so workers only write into memory owned by target.
+    uchar *bits = target->bits();
+    const int bpl = target->bytesPerLine();
+    const int bpp = target->depth() >> 3;
+    const QImage::Format format = target->format();
+
+    auto compositeTile = [&](const QRect &tile){
+        QImage view(bits + tile.y() * bpl + tile.x() * bpp,
+                    tile.width(), tile.height(),
+                    bpl, format);
+        view.fill(background);
+        QPainter painter(&view);
+        for(const LayerPointer &layer: layers){
+            layer->paint(&painter, tile);
+        }
+    };
+
+    if(qint64(area.width()) * area.height() < PARALLEL_THRESHOLD){
+        compositeTile(area);
+        return;
+    }
+
+    QVector<QRect> tiles = tilesOf(area);
+    QtConcurrent::blockingMap(tiles, compositeTile);
+}
@@ -0,0 +1,28 @@
+#ifndef TILECOMPOSITOR_H
+#define TILECOMPOSITOR_H
+
+#include <QList>
+#include <QVector>
+#include <QRect>
+#include <QColor>
+#include "layer.h"
+
+class QImage;
+
+class TileCompositor
+{
+public:
+    enum : int {
+        TILE_SIZE = 256,
+        // dirty areas smaller than this (in pixels) are composited inline
+        PARALLEL_THRESHOLD = 512*512
+    };
+
+    static QVector<QRect> tilesOf(const QRect &rect);
+    static void composite(QImage *target,
+                          const QList<LayerPointer> &layers,
+                          const QRect &rect,
+                          const QColor &background = Qt::white);
+};
+
+#endif // TILECOMPOSITOR_H
@@ -86,6 +86,23 @@ void AbstractBrush::setSurface(Surface surface)
     surface_ = surface;
 }
 
+/*!
+    \fn void AbstractBrush::flush()
+
+    Brushes may collect a stroke before they write it into the surface.
+    flush() writes all of it, and is called before the surface is read.
+    The area was reported by takeDirtyRect() already.
+*/
+
+void AbstractBrush::flush()
+{
+}
+
+void AbstractBrush::endStroke()
+{
+    flush();
+}
+
 bool AbstractBrush::support(const BrushFeature::FEATURE &f)
 {
     return features_.support(f);
@@ -96,6 +113,25 @@ BrushFeature AbstractBrush::features()
     return features_;
 }
 
+QRect AbstractBrush::affectedRect(const QPoint &end) const
+{
+    const int rad = (width_ >> 1) + 2;
+    return QRect(last_point_, end).normalized()
+            .adjusted(-rad, -rad, rad, rad);
+}
+
+QRect AbstractBrush::takeDirtyRect()
+{
+    QRect rect = dirty_rect_;
+    dirty_rect_ = QRect();
+    return rect;
+}
+
+void AbstractBrush::addDirtyRect(const QRect &rect)
+{
+    dirty_rect_ |= rect;
+}
+
 BrushSettings AbstractBrush::settings() const
 {
     return settings_;
@@ -2,6 +2,7 @@
 #define ABSTRACTBRUSH_H
 
 #include <QPoint>
+#include <QRect>
 #include <QImage>
 #include <QIcon>
 #include <QCursor>
@@ -44,6 +45,14 @@ public:
 
     virtual void drawPoint(const QPoint& p, qreal pressure=1)=0;
     virtual void drawLineTo(const QPoint& end, qreal pressure=1)=0;
+    // area that drawLineTo(end) may touch, known before drawing
+    virtual QRect affectedRect(const QPoint& end) const;
+    // area actually painted since the last call
+    QRect takeDirtyRect();
+    // writes what was drawn but not yet into the surface
+    virtual void flush();
+    // the current stroke is over
+    virtual void endStroke();
 
     virtual BrushSettings settings() const;
     virtual void setSettings(const BrushSettings &settings);
@@ -59,6 +68,7 @@ protected:
     QPoint last_point_;
     BrushSettings settings_;
     BrushFeature features_;
+    QRect dirty_rect_;
 
     QString name_;
     QString displayName_;
@@ -67,6 +77,7 @@ protected:
     QKeySequence shortcut_;
 
     virtual void updateCursor(int w);
+    void addDirtyRect(const QRect &rect);
 };
 
 #endif // ABSTRACTBRUSH_H
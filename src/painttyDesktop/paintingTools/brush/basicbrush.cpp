@@ -1,13 +1,13 @@
 #include "basicbrush.h"
-#include <QRadialGradient>
-#include <QPainter>
-#include <QEasingCurve>
-#include <QPen>
-#include <QBrush>
+#include <QVarLengthArray>
 #include <QtCore/qmath.h>
+#include <cmath>
+#include <string.h>
 #include <QtGlobal>
 #include <QDebug>
 
+#include "dabblitter.h"
+#include "capsulerasterizer.h"
 #include "../../misc/shortcutmanager.h"
 #include "../../misc/singleton.h"
 
@@ -18,7 +18,12 @@ typedef BrushFeature::LIMIT BFL;
 BasicBrush::BasicBrush() :
     AbstractBrush(),
     left_(0),
-    hardness_(BFL::HARDNESS_MAX)
+    hardness_(BFL::HARDNESS_MAX),
+    capsule_strokes_(true),
+    wash_strokes_(true),
+    falloff_width_(0),
+    falloff_hardness_(0),
+    falloff_thickness_(0)
 {
     typedef BrushFeature BF;
     BF::FeatureBits bits;
@@ -38,87 +43,266 @@ BasicBrush::BasicBrush() :
 void BasicBrush::setWidth(int width)
 {
     AbstractBrush::setWidth(width);
-    makeStencil(color_);
+    updateStencil();
 }
 
 void BasicBrush::setColor(const QColor &color)
 {
     AbstractBrush::setColor(color);
-    makeStencil(color_);
+    updateStencil();
 }
 
 void BasicBrush::setThickness(int thickness)
 {
     AbstractBrush::setThickness(thickness);
+    updateStencil();
+}
+
+void BasicBrush::setSurface(Surface surface)
+{
+    if(surface != surface_){
+        endStroke();
+    }
+    AbstractBrush::setSurface(surface);
+}
+
+void BasicBrush::updateStencil()
+{
+    // the rest of a stroke is not capped with the old settings
+    endStroke();
     makeStencil(color_);
+    pressure_stencils_.clear();
+}
+
+/*!
+    \fn const QImage &BasicBrush::pressureStencil(qreal pressure)
+
+    Returns the stencil scaled to \a pressure. Scaled widths are
+    quantized to at most PRESSURE_LEVELS steps, and each step is scaled
+    once, then kept until the stencil changes. Brushes no wider than
+    PRESSURE_LEVELS get exactly the width they would get unquantized.
+*/
+
+const QImage &BasicBrush::pressureStencil(qreal pressure)
+{
+    const int full = stencil_.width();
+    const int step = qMax(1, (full + PRESSURE_LEVELS - 1) / PRESSURE_LEVELS);
+    const int level = int(full * qBound<qreal>(0, pressure, 1)) / step;
+    if(level * step >= full){
+        return stencil_;
+    }
+    if(pressure_stencils_.isEmpty()){
+        pressure_stencils_.resize(full / step + 1);
+    }
+    QImage &stencil = pressure_stencils_[level];
+    if(stencil.isNull() && level > 0){
+        stencil = stencil_.scaledToWidth(level * step);
+    }
+    return stencil;
+}
+
+/*!
+    \fn void BasicBrush::makeFalloff(int width)
+
+    Computes the alpha of a stencil \a width pixels wide, before it is
+    colored. It is kept until width, hardness or thickness change, so a
+    new color only needs tintDabRow() over it.
+
+    The stencil used to be a QRadialGradient whose focal circle grows
+    with hardness, with stops along QEasingCurve::OutQuart. That curve
+    falls off as (1 - t)^4 over the gradient, which is evaluated here
+    directly, at pixel centers like the raster engine.
+*/
+
+void BasicBrush::makeFalloff(int width)
+{
+    falloff_width_ = width;
+    falloff_hardness_ = hardness_;
+    falloff_thickness_ = thickness_;
+    falloff_.resize(width * width);
+
+    const int half_width = width>>1;
+    const qreal outer = half_width;
+    // make it soft to fake an Anti-aliasing effect
+    const qreal inner = half_width * hardness_ * 0.01 - 1;
+    const float to_t = 1.0 / (outer - inner);
+    const float scale = hardness_ / 500.0 * thickness_ / 100.0 * 255;
+
+    QVarLengthArray<float, 128> dx2(width);
+    for(int x = 0; x < width; ++x){
+        const float dx = x + 0.5f - half_width;
+        dx2[x] = dx * dx;
+    }
+    uchar *falloff = falloff_.data();
+    for(int y = 0; y < width; ++y){
+        uchar *row = falloff + y * width;
+        // rows mirror around the center
+        const int mirror = 2 * half_width - 1 - y;
+        if(mirror >= 0 && mirror < y){
+            memcpy(row, falloff + mirror * width, width);
+            continue;
+        }
+        const float dy = y + 0.5f - half_width;
+        const float dy2 = dy * dy;
+        for(int x = 0; x < width; ++x){
+            const float t = qBound(0.0f,
+                                   (std::sqrt(dx2[x] + dy2) - float(inner)) * to_t,
+                                   1.0f);
+            float a = (1 - t) * (1 - t);
+            a *= a;
+            row[x] = uchar(a * scale + 0.5f);
+        }
+    }
 }
 
 void BasicBrush::makeStencil(QColor color)
 {
-    auto checked_width = width_ < 4 ? 4 : width_;
+    const int checked_width = width_ < 4 ? 4 : width_;
+    if(falloff_.isEmpty() || falloff_width_ != checked_width
+            || falloff_hardness_ != hardness_
+            || falloff_thickness_ != thickness_){
+        makeFalloff(checked_width);
+    }
     if(stencil_.isNull() || stencil_.width() != checked_width){
         stencil_ = QImage(checked_width, checked_width, QImage::Format_ARGB32_Premultiplied);
     }
-    auto oc = color;
-    stencil_.fill(Qt::transparent);
-    const QEasingCurve easing(QEasingCurve::OutQuart);
-
-    const int half_width = checked_width>>1;
-
-    const QPoint center(half_width, half_width);
-    QPainter painter;
-    if(!painter.begin(&stencil_)){
-        return;
+    const quint32 premultiplied = qPremultiply(color.rgba());
+    for(int y = 0; y < checked_width; ++y){
+        tintDabRow(reinterpret_cast<quint32 *>(stencil_.scanLine(y)),
+                   premultiplied,
+                   falloff_.constData() + y * checked_width,
+                   checked_width);
     }
-    QRadialGradient gradient(center, half_width);
-    const qreal thk = hardness_/500.0;
-    for(int i=0;i<100;++i){
-        const qreal value = i/100.0;
-//        qreal thk = 0.03;
-        color.setAlphaF((1-easing.valueForProgress(value))*thk);
-        gradient.setColorAt(value, color);
-    }
-    gradient.setColorAt(1, Qt::transparent);
-    gradient.setCenterRadius(half_width);
-    const qreal r_h = hardness_*0.01; // make it soft to fake an Anti-aliasing effect
-//    qreal r_h = 0.8;
-    gradient.setFocalRadius(half_width*r_h -1);
-    const QBrush brush(gradient);
-    const QPen pen(brush, checked_width);
-    painter.setPen(pen);
-    painter.setOpacity(thickness_/100.0*oc.alphaF());
-    painter.drawPoint(half_width, half_width);
-    painter.end();
 }
 
 void BasicBrush::drawPointInternal(const QPoint &p,
                                    const QImage& stencil,
-                                   QPainter* painter)
+                                   QImage *surface)
 {
     // TODO: add pressure
-    bool need_delete = false;
-    if(!painter) {
-        painter = new QPainter;
-        need_delete = true;
-        painter->setRenderHint(QPainter::Antialiasing);
-        painter->begin(surface_->imagePtr());
+    if(wash_.isActive()){
+        addDirtyRect(wash_.addDab(stencil, p));
+    }else{
+        addDirtyRect(blendDab(surface, stencil, p));
     }
-    painter->drawImage(p.x(), p.y(), stencil);
-    if(need_delete) {
-        painter->end();
-        delete painter;
+}
+
+/*!
+    \fn bool BasicBrush::drawCapsule(const QPoint &start, const QPoint &end,
+                                     qreal pressure, QImage *surface)
+
+    Draws the segment from \a start to \a end in one pass, without
+    stamping dabs. Returns false if the brush cannot, and the segment
+    is drawn dab by dab instead.
+
+    A fully hard stencil is a flat disc with a rim one pixel wide that
+    fades out as (1 - t)^4, see makeFalloff(). Stamping it every spacing
+    pixels only builds up alpha with the number of dabs that cover a
+    pixel, and with how much of the rim does. stackCapsule() computes
+    that directly, rim included, so edges stay antialiased.
+
+    Computing a pixel that way costs far more than blending a dab into
+    it, so it only wins where many dabs overlap: thin brushes drawing
+    long segments. Other segments are stamped.
+*/
+
+bool BasicBrush::drawCapsule(const QPoint &start, const QPoint &end,
+                             qreal pressure, QImage *surface)
+{
+    if(!capsule_strokes_ || hardness_ < BFL::HARDNESS_MAX){
+        return false;
     }
+    const qreal width = width_*pressure;
+    const qreal spacing = width*0.07;
+    const QPoint delta = end - start;
+    if(spacing <= 0 || width > CAPSULE_MAX_WIDTH
+            || QPoint::dotProduct(delta, delta)
+            < width * width * CAPSULE_MIN_LENGTH * CAPSULE_MIN_LENGTH){
+        return false;
+    }
+    const QImage &stencil = pressureStencil(pressure);
+    if(stencil.isNull()){
+        return false;
+    }
+    // the color and alpha of a single dab, at its center
+    const QRgb center = stencil.pixel(stencil.width()>>1, stencil.height()>>1);
+    if(!qAlpha(center)){
+        return true;
+    }
+    const quint32 color = qUnpremultiply(center) | 0xff000000;
+    // the rim is the last pixel of the full stencil, and scales with it
+    const qreal rim = qreal(stencil.width()) / stencil_.width();
+    const qreal radius = (stencil_.width()>>1) * rim;
+    const qreal alpha = qAlpha(center) / 255.0;
+    if(wash_.isActive()){
+        addDirtyRect(stackCapsuleAlpha(surface_->imageConstPtr()->size(),
+                                       start, end, radius, rim, alpha,
+                                       spacing,
+                                       [this](int x, int y, const uchar *a, int count){
+            wash_.addRow(x, y, a, count);
+        }));
+    }else{
+        addDirtyRect(stackCapsule(surface, start, end, radius, rim, color,
+                                  alpha, spacing));
+    }
+    return true;
+}
+
+/*!
+    \fn void BasicBrush::flush()
+
+    Writes the stroke collected in the wash into the surface. Within
+    a stroke, dabs build up in the wash only, so the surface is read
+    and written once per flush, rather than once per dab.
+*/
+
+void BasicBrush::flush()
+{
+    // the surface is only asked for pixels to write when there are any
+    if(wash_.hasPending() && surface_){
+        if(!wash_.flush(surface_->imagePtr()).isEmpty()){
+            surface_->markModified();
+        }
+    }
+}
+
+/*!
+    \fn QImage *BasicBrush::washSurface()
+
+    Returns the surface dabs are drawn into, or null while they go
+    into the wash. The surface is not written until the next flush
+    then, which is what marks it modified.
+*/
+
+QImage *BasicBrush::washSurface()
+{
+    return wash_.isActive() ? nullptr : surface_->imagePtr();
+}
+
+void BasicBrush::endStroke()
+{
+    flush();
+    wash_.end();
 }
 
 void BasicBrush::drawPoint(const QPoint &p, qreal pr)
 {
-    QPainter painter(surface_->imagePtr());
-    painter.setRenderHint(QPainter::Antialiasing);
-    QImage pressure_stencil = stencil_.scaledToWidth(stencil_.width()*pr);
+    // a point starts a new stroke, which can get as opaque as
+    // its thickness and color allow, but no more
+    if(wash_strokes_){
+        endStroke();
+        wash_.begin(surface_->imageConstPtr()->size(), color_.rgb(),
+                    qRound(thickness_ / 100.0 * color_.alphaF() * 255));
+    }
+    const QImage &pressure_stencil = pressureStencil(pr);
+    QImage *surface = washSurface();
     drawPointInternal(QPoint(p.x() - (pressure_stencil.width()>>1),
                              p.y() - (pressure_stencil.height()>>1)),
                       pressure_stencil,
-                      &painter);
+                      surface);
+    if(surface){
+        surface_->markModified();
+    }
     last_point_ = p;
 }
 
@@ -129,57 +313,80 @@ void BasicBrush::drawLineTo(const QPoint &end, qreal pressure)
         return;
     }
     const QPoint& start = last_point_;
-    // TODO: spacing needs to be calc with thickness and hardness, too
-    const qreal spacing = width_*pressure*0.07;
-
-    const qreal deltaX = end.x() - start.x();
-    const qreal deltaY = end.y() - start.y();
-
-    const qreal distance = qSqrt( deltaX * deltaX + deltaY * deltaY );
-    qreal stepX = 0.0;
-    qreal stepY = 0.0;
-    if ( distance > 0.0 ) {
-        qreal invertDistance = 1.0 / distance;
-        stepX = deltaX * invertDistance;
-        stepY = deltaY * invertDistance;
-    }
-
-    qreal offsetX = 0.0;
-    qreal offsetY = 0.0;
-
-    qreal totalDistance = left_ + distance;
-    // TODO
-    QImage pressure_stencil = stencil_.scaledToWidth(stencil_.width()*pressure);
-
-    QPainter painter(surface_->imagePtr());
-    painter.setRenderHint(QPainter::Antialiasing);
-    while ( totalDistance >= spacing ) {
-        if ( left_ > 0.0 ) {
-            offsetX += stepX * (spacing - left_);
-            offsetY += stepY * (spacing - left_);
-            drawPointInternal(QPoint(start.x() + offsetX - (pressure_stencil.width()>>1),
-                                     start.y() + offsetY - (pressure_stencil.height()>>1)),
-                              pressure_stencil,
-                              &painter);
-            left_ -= spacing;
-        } else {
-            offsetX += stepX * spacing;
-            offsetY += stepY * spacing;
-            drawPointInternal(QPoint(start.x() + offsetX - (pressure_stencil.width()>>1),
-                                     start.y() + offsetY - (pressure_stencil.height()>>1)),
-                              pressure_stencil,
-                              &painter);
-        }
-        totalDistance -= spacing;
+    QImage *surface = washSurface();
+    if(drawCapsule(start, end, pressure, surface)){
+        left_ = 0;
+    }else{
+        // TODO: spacing needs to be calc with thickness and hardness, too
+        const qreal spacing = width_*pressure*0.07;
+        drawDabs(start, end, spacing, pressureStencil(pressure), surface);
+    }
+    if(surface){
+        surface_->markModified();
     }
-    left_ = totalDistance;
     last_point_ = end;
 }
 
+/*!
+    \fn void BasicBrush::drawDabs(const QPoint &start, const QPoint &end,
+                                  qreal spacing, const QImage &stencil,
+                                  QImage *surface)
+
+    Stamps \a stencil every \a spacing pixels from \a start to \a end.
+    Called once per segment; whether dabs go into the wash or straight
+    into \a surface is decided here, outside of the loop over dabs, and
+    so is whether they need clipping to \a surface at all. \a surface
+    is null while dabs go into the wash, see washSurface().
+*/
+
+void BasicBrush::drawDabs(const QPoint &start, const QPoint &end,
+                          qreal spacing, const QImage &stencil,
+                          QImage *surface)
+{
+    if(wash_.isActive()){
+        stampLine(start, end, spacing, stencil.size(),
+                  [&](const QPoint &p){
+            addDirtyRect(wash_.addDab(stencil, p));
+        });
+        return;
+    }
+    // every dab of the segment lies within a stencil of its ends, so
+    // if that lies inside the surface, no dab needs to be clipped
+    const QSize size = stencil.size();
+    const QRect reach(QPoint(qMin(start.x(), end.x()) - size.width(),
+                             qMin(start.y(), end.y()) - size.height()),
+                      QPoint(qMax(start.x(), end.x()) + size.width(),
+                             qMax(start.y(), end.y()) + size.height()));
+    if(surface->rect().contains(reach)){
+        uchar *bits = surface->bits();
+        const int bpl = surface->bytesPerLine();
+        stampLine(start, end, spacing, size,
+                  [&](const QPoint &p){
+            addDirtyRect(blendDabInside(bits, bpl, stencil, p));
+        });
+    }else{
+        stampLine(start, end, spacing, size,
+                  [&](const QPoint &p){
+            addDirtyRect(blendDab(surface, stencil, p));
+        });
+    }
+}
+
 AbstractBrush *BasicBrush::createBrush()
 {
     return new BasicBrush;
 }
+
+bool BasicBrush::capsuleStrokes() const
+{
+    return capsule_strokes_;
+}
+
+void BasicBrush::setCapsuleStrokes(bool enabled)
+{
+    capsule_strokes_ = enabled;
+}
+
 int BasicBrush::hardness() const
 {
     return hardness_;
@@ -189,7 +396,7 @@ void BasicBrush::setHardness(int hardness)
 {
     hardness_ = qBound<int>(BFL::HARDNESS_MIN, hardness, BFL::HARDNESS_MAX);
     settings_.insert("hardness", hardness_);
-    makeStencil(color_);
+    updateStencil();
 }
 
 void BasicBrush::setSettings(const BrushSettings &settings)
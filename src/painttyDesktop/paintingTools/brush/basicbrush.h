@@ -2,7 +2,10 @@
 #define BASICBRUSH_H
 
 #include "abstractbrush.h"
+#include "strokewash.h"
 #include <QImage>
+#include <QVector>
+#include <QtCore/qmath.h>
 
 class BasicBrush : public AbstractBrush
 {
@@ -11,14 +14,20 @@ public:
     void setWidth(int width) Q_DECL_OVERRIDE;
     void setColor(const QColor &color) Q_DECL_OVERRIDE;
     void setThickness(int thickness) Q_DECL_OVERRIDE;
+    void setSurface(Surface surface) Q_DECL_OVERRIDE;
 
     void drawPoint(const QPoint& p, qreal pressure=1) Q_DECL_OVERRIDE;
     void drawLineTo(const QPoint& end, qreal pressure=1) Q_DECL_OVERRIDE;
+    void flush() Q_DECL_OVERRIDE;
+    void endStroke() Q_DECL_OVERRIDE;
 
     AbstractBrush* createBrush() Q_DECL_OVERRIDE;
 
     int hardness() const;
     void setHardness(int hardness);
+    // whether segments may be drawn as capsules instead of dabs
+    bool capsuleStrokes() const;
+    void setCapsuleStrokes(bool enabled);
 
     void setSettings(const BrushSettings &settings) Q_DECL_OVERRIDE;
     BrushSettings defaultSettings() const Q_DECL_OVERRIDE;
@@ -28,10 +37,92 @@ signals:
 public slots:
 
 protected:
+    enum : int {
+        PRESSURE_LEVELS = 32,
+        // stacked capsules only pay off for brushes this thin, on
+        // segments this many widths long
+        CAPSULE_MAX_WIDTH = 14,
+        CAPSULE_MIN_LENGTH = 12
+    };
+
     qreal left_;
     int hardness_;
+    bool capsule_strokes_;
+    // strokes build up in wash_ and are capped by thickness,
+    // set by brushes that draw with one color only
+    bool wash_strokes_;
+    StrokeWash wash_;
+    // uncolored alpha of the stencil, and what it was made for
+    QVector<uchar> falloff_;
+    int falloff_width_;
+    int falloff_hardness_;
+    int falloff_thickness_;
+    void makeFalloff(int width);
+    // stencil scaled for pressure, built on first use
+    QVector<QImage> pressure_stencils_;
+    void updateStencil();
+    const QImage &pressureStencil(qreal pressure);
     virtual void makeStencil(QColor color);
-    virtual void drawPointInternal(const QPoint& p, const QImage &stencil, QPainter *painter);
+    virtual void drawPointInternal(const QPoint& p, const QImage &stencil, QImage *surface);
+    virtual void drawDabs(const QPoint &start, const QPoint &end, qreal spacing,
+                          const QImage &stencil, QImage *surface);
+    template<typename Dab>
+    void stampLine(const QPoint &start, const QPoint &end, qreal spacing,
+                   const QSize &size, Dab dab);
+    virtual bool drawCapsule(const QPoint &start, const QPoint &end,
+                             qreal pressure, QImage *surface);
+    QImage *washSurface();
 };
 
+/*!
+    \fn void BasicBrush::stampLine(const QPoint &start, const QPoint &end,
+                                   qreal spacing, const QSize &size, Dab dab)
+
+    Walks the segment from \a start to \a end every \a spacing pixels,
+    carrying the distance left over from the previous segment, and calls
+    \a dab with the top left corner of a dab of \a size at each step.
+
+    The walk is a template so that \a dab, usually a lambda, is inlined
+    into the loop: brushes pick how to draw a dab once per segment in
+    drawDabs(), not once per dab through a virtual call.
+*/
+
+template<typename Dab>
+void BasicBrush::stampLine(const QPoint &start, const QPoint &end,
+                           qreal spacing, const QSize &size, Dab dab)
+{
+    const qreal deltaX = end.x() - start.x();
+    const qreal deltaY = end.y() - start.y();
+
+    const qreal distance = qSqrt( deltaX * deltaX + deltaY * deltaY );
+    qreal stepX = 0.0;
+    qreal stepY = 0.0;
+    if ( distance > 0.0 ) {
+        qreal invertDistance = 1.0 / distance;
+        stepX = deltaX * invertDistance;
+        stepY = deltaY * invertDistance;
+    }
+
+    qreal offsetX = 0.0;
+    qreal offsetY = 0.0;
+
+    qreal totalDistance = left_ + distance;
+    const int half_width = size.width()>>1;
+    const int half_height = size.height()>>1;
+    while ( totalDistance >= spacing ) {
+        if ( left_ > 0.0 ) {
+            offsetX += stepX * (spacing - left_);
+            offsetY += stepY * (spacing - left_);
+            left_ -= spacing;
+        } else {
+            offsetX += stepX * spacing;
+            offsetY += stepY * spacing;
+        }
+        dab(QPoint(start.x() + offsetX - half_width,
+                   start.y() + offsetY - half_height));
+        totalDistance -= spacing;
+    }
+    left_ = totalDistance;
+}
+
 #endif // BASICBRUSH_H
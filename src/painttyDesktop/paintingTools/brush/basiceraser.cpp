@@ -1,15 +1,11 @@
 #include "basiceraser.h"
+#include "capsulerasterizer.h"
 
 #include "../../misc/shortcutmanager.h"
 #include "../../misc/singleton.h"
 
 BasicEraser::BasicEraser()
-    :brush_(Qt::transparent),
-      pen_(Qt::transparent)
 {
-    pen_.setCapStyle(Qt::RoundCap);
-    pen_.setJoinStyle(Qt::RoundJoin);
-
     typedef BrushFeature BF;
     BF::FeatureBits bits;
     bits.set(BF::WIDTH);
@@ -22,29 +18,19 @@ BasicEraser::BasicEraser()
     icon_ = QIcon(":/iconset/ui/brush/basiceraser.png");
 }
 
+// erases what an antialiased round pen of the brush width would cover
 void BasicEraser::drawPoint(const QPoint &p, qreal )
 {
-    pen_.setWidth(width_);
-    painter_.begin(surface_->imagePtr());
-    painter_.setRenderHint(QPainter::Antialiasing);
-    painter_.setCompositionMode(QPainter::CompositionMode_Clear);
-    painter_.setPen(pen_);
-    painter_.setBrush(brush_);
-    painter_.drawPoint(p);
-    painter_.end();
+    addDirtyRect(clearCapsule(surface_->imagePtr(), p, p, width_ / 2.0));
+    surface_->markModified();
     last_point_ = p;
 }
 
 void BasicEraser::drawLineTo(const QPoint &end, qreal )
 {
-    pen_.setWidth(width_);
-    painter_.begin(surface_->imagePtr());
-    painter_.setRenderHint(QPainter::Antialiasing);
-    painter_.setCompositionMode(QPainter::CompositionMode_Clear);
-    painter_.setPen(pen_);
-    painter_.setBrush(brush_);
-    painter_.drawLine(last_point_, end);
-    painter_.end();
+    addDirtyRect(clearCapsule(surface_->imagePtr(), last_point_, end,
+                              width_ / 2.0));
+    surface_->markModified();
     last_point_ = end;
 }
 
@@ -2,14 +2,15 @@
 #include <QPainter>
 #include <QPen>
 #include <QBrush>
-#include <QPainter>
 
+#include "capsulerasterizer.h"
 #include "../../misc/shortcutmanager.h"
 #include "../../misc/singleton.h"
 
 BinaryBrush::BinaryBrush() :
     BasicBrush()
 {
+    wash_strokes_ = false;
     typedef BrushFeature BF;
     BF::FeatureBits bits;
     bits.set(BF::WIDTH);
@@ -55,3 +56,24 @@ void BinaryBrush::makeStencil(QColor color)
     painter.drawEllipse(center, half_width>>1, half_width>>1);
     painter.end();
 }
+
+// Stamped dabs of an opaque color cover what one hard edged capsule
+// covers, translucent ones build up and are still stamped.
+bool BinaryBrush::drawCapsule(const QPoint &start, const QPoint &end,
+                              qreal pressure, QImage *surface)
+{
+    if(!capsule_strokes_ || color_.alpha() != 255){
+        return false;
+    }
+    const QImage &stencil = pressureStencil(pressure);
+    if(stencil.isNull()){
+        return false;
+    }
+    // the ellipse in makeStencil() is half as wide as the stencil,
+    // and its outline reaches half a pixel further
+    const qreal scale = qreal(stencil.width()) / stencil_.width();
+    const qreal radius = ((stencil_.width()>>1)>>1) * scale + 0.5;
+    addDirtyRect(fillCapsule(surface, start, end, radius,
+                             qPremultiply(color_.rgba())));
+    return true;
+}
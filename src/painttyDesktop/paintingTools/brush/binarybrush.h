@@ -16,6 +16,8 @@ public slots:
 
 protected:
     void makeStencil(QColor color) Q_DECL_OVERRIDE;
+    bool drawCapsule(const QPoint &start, const QPoint &end,
+                     qreal pressure, QImage *surface) Q_DECL_OVERRIDE;
 
 };
 
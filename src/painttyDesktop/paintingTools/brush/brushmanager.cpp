@@ -1,18 +1,50 @@
 #include "brushmanager.h"
 #include "abstractbrush.h"
 #include "basicbrush.h"
+#include "binarybrush.h"
+#include "sketchbrush.h"
+#include "basiceraser.h"
+#include "maskbased.h"
 #include <QDebug>
 
 bool BrushManager::addBrush(BrushPointer brush)
 {
-    registeredBrushes_.insert(
-                brush->name()
-                .trimmed()
-                .toLower(),
-                brush);
+    const QString name = brush->name()
+            .trimmed()
+            .toLower();
+    registeredBrushes_.insert(name, brush);
+    auto it = typeIds_.constFind(name);
+    if(it == typeIds_.constEnd()){
+        typeIds_.insert(name, types_.count());
+        types_.append(brush);
+    }else{
+        types_[it.value()] = brush;
+    }
     return true;
 }
 
+// registers the brushes the client ships with
+void BrushManager::addBuiltinBrushes()
+{
+    BrushPointer p1(new BasicBrush);
+    p1->setSettings(p1->defaultSettings());
+    BrushPointer p2(new BinaryBrush);
+    p2->setSettings(p1->defaultSettings());
+    BrushPointer p3(new SketchBrush);
+    p3->setSettings(p1->defaultSettings());
+    BrushPointer p4(new BasicEraser);
+    p4->setSettings(p1->defaultSettings());
+    // WaterBased is left out: it samples the layer and re-tints its
+    // stencil for every dab, and costs several times what BasicBrush does
+    BrushPointer p6(new MaskBased);
+    p6->setSettings(p1->defaultSettings());
+    addBrush(p1);
+    addBrush(p2);
+    addBrush(p3);
+    addBrush(p4);
+    addBrush(p6);
+}
+
 QList<BrushPointer> BrushManager::allBrushes()
 {
     return registeredBrushes_.values();
@@ -42,3 +74,25 @@ BrushPointer BrushManager::makeBrush(const QString &name)
     nptr->setSettings(nptr->defaultSettings());
     return nptr;
 }
+
+int BrushManager::typeOf(const QString &name) const
+{
+    return typeIds_.value(name
+                          .trimmed()
+                          .toLower(), -1);
+}
+
+BrushPointer BrushManager::makeBrush(int type)
+{
+    if(type < 0 || type >= types_.count()){
+        qWarning()<<"Brush type"<<type<<" cannot identify";
+
+        // use Brush to fall back
+        BrushPointer nptr = BrushPointer(new BasicBrush);
+        nptr->setSettings(nptr->defaultSettings());
+        return nptr;
+    }
+    BrushPointer nptr = BrushPointer(types_[type]->createBrush());
+    nptr->setSettings(nptr->defaultSettings());
+    return nptr;
+}
@@ -3,6 +3,8 @@
 
 #include <QSharedPointer>
 #include <QMap>
+#include <QHash>
+#include <QVector>
 
 class AbstractBrush;
 
@@ -12,11 +14,17 @@ class BrushManager
 {
 public:
     bool addBrush(BrushPointer brush);
+    void addBuiltinBrushes();
     QList<BrushPointer> allBrushes();
     BrushPointer getBrush(const QString &name);
     BrushPointer makeBrush(const QString &name);
+    // brush types as small ids, resolved once instead of on every lookup
+    int typeOf(const QString &name) const;
+    BrushPointer makeBrush(int type);
 private:
     QMap<QString, BrushPointer> registeredBrushes_;
+    QHash<QString, int> typeIds_;
+    QVector<BrushPointer> types_;
 };
 
 #endif // BRUSHMANAGER_H
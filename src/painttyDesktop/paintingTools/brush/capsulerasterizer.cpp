@@ -0,0 +1,344 @@
+#include "capsulerasterizer.h"
+#include "dabblitter.h"
+
+#include <QVarLengthArray>
+#include <QtMath>
+#include <limits>
+
+namespace {
+
+struct Capsule
+{
+    Capsule(const QPointF &start, const QPointF &end)
+        :ax(start.x()),
+          ay(start.y()),
+          dx(end.x() - start.x()),
+          dy(end.y() - start.y())
+    {
+        length2 = dx * dx + dy * dy;
+        length = qSqrt(length2);
+    }
+
+    qreal ax;
+    qreal ay;
+    qreal dx;
+    qreal dy;
+    qreal length2;
+    qreal length;
+
+    // squared distance from (px, py) to the segment
+    qreal distance2(qreal px, qreal py) const
+    {
+        const qreal rx = px - ax;
+        const qreal ry = py - ay;
+        qreal t = 0;
+        if(length2 > 0){
+            t = qBound<qreal>(0, (rx * dx + ry * dy) / length2, 1);
+        }
+        const qreal ex = rx - t * dx;
+        const qreal ey = ry - t * dy;
+        return ex * ex + ey * ey;
+    }
+};
+
+// pixel rows and columns of a surface a capsule may reach
+struct Bounds
+{
+    int top;
+    int bottom;
+    int width;
+};
+
+}
+
+static Bounds rowBounds(const QSize &size, const Capsule &c, qreal radius)
+{
+    const qreal top = qMin(c.ay, c.ay + c.dy) - radius;
+    const qreal bottom = qMax(c.ay, c.ay + c.dy) + radius;
+    Bounds bounds;
+    // rows whose center lies in [top, bottom]
+    bounds.top = qMax(0, qCeil(top - 0.5));
+    bounds.bottom = qMin(size.height() - 1, qFloor(bottom - 0.5));
+    bounds.width = size.width();
+    return bounds;
+}
+
+// Finds the columns [*begin, *end) of the surface whose pixel centers
+// on the row at py lie within radius of the segment. As a capsule is
+// convex, they are the hull of what its end circles and its body cover.
+static bool capsuleSpan(const Capsule &c, qreal radius, qreal py,
+                        int width, int *begin, int *end)
+{
+    qreal left = std::numeric_limits<qreal>::max();
+    qreal right = -std::numeric_limits<qreal>::max();
+    auto circle = [&](qreal cx, qreal cy){
+        const qreal h = py - cy;
+        if(qAbs(h) <= radius){
+            const qreal w = qSqrt(radius * radius - h * h);
+            left = qMin(left, cx - w);
+            right = qMax(right, cx + w);
+        }
+    };
+    circle(c.ax, c.ay);
+    circle(c.ax + c.dx, c.ay + c.dy);
+
+    if(c.length2 > 0){
+        // the body is where the projection falls on the segment and
+        // the distance to its line is within radius, each of which is
+        // an interval of t = x - ax on this row
+        qreal lo = -std::numeric_limits<qreal>::max();
+        qreal hi = std::numeric_limits<qreal>::max();
+        auto clip = [&](qreal a, qreal b, qreal min, qreal max){
+            // min <= a * t + b <= max
+            if(a == 0){
+                if(b < min || b > max){
+                    lo = 1;
+                    hi = 0;
+                }
+                return;
+            }
+            qreal t0 = (min - b) / a;
+            qreal t1 = (max - b) / a;
+            if(t0 > t1){
+                qSwap(t0, t1);
+            }
+            lo = qMax(lo, t0);
+            hi = qMin(hi, t1);
+        };
+        const qreal ry = py - c.ay;
+        clip(c.dx, ry * c.dy, 0, c.length2);
+        clip(c.dy, -ry * c.dx, -radius * c.length, radius * c.length);
+        if(lo <= hi){
+            left = qMin(left, c.ax + lo);
+            right = qMax(right, c.ax + hi);
+        }
+    }
+    if(left > right){
+        return false;
+    }
+    *begin = qMax(0, qCeil(left - 0.5));
+    *end = qMin(width, qFloor(right - 0.5) + 1);
+    return *begin < *end;
+}
+
+static inline quint32 *scanLine(QImage *surface, int y)
+{
+    return reinterpret_cast<quint32 *>(surface->scanLine(y));
+}
+
+QRect fillCapsule(QImage *surface, const QPointF &start, const QPointF &end,
+                  qreal radius, quint32 color)
+{
+    Q_ASSERT(surface->format() == QImage::Format_ARGB32_Premultiplied);
+    const Capsule c(start, end);
+    const Bounds bounds = rowBounds(surface->size(), c, radius);
+    QRect dirty;
+    for(int y = bounds.top; y <= bounds.bottom; ++y){
+        int begin, last;
+        if(!capsuleSpan(c, radius, y + 0.5, bounds.width, &begin, &last)){
+            continue;
+        }
+        fillDabRow(scanLine(surface, y) + begin, color, last - begin);
+        dirty |= QRect(begin, y, last - begin, 1);
+    }
+    return dirty;
+}
+
+QRect clearCapsule(QImage *surface, const QPointF &start, const QPointF &end,
+                   qreal radius)
+{
+    Q_ASSERT(surface->format() == QImage::Format_ARGB32_Premultiplied);
+    const Capsule c(start, end);
+    // coverage ramps from 0 to 1 over the pixel across the edge
+    const qreal outer = radius + 0.5;
+    const qreal inner = radius - 0.5;
+    const Bounds bounds = rowBounds(surface->size(), c, outer);
+    QVarLengthArray<uchar, 256> coverage;
+    QRect dirty;
+    for(int y = bounds.top; y <= bounds.bottom; ++y){
+        const qreal py = y + 0.5;
+        int begin, last;
+        if(!capsuleSpan(c, outer, py, bounds.width, &begin, &last)){
+            continue;
+        }
+        coverage.resize(last - begin);
+        int inner_begin = last;
+        int inner_end = last;
+        if(inner <= 0 || !capsuleSpan(c, inner, py, bounds.width,
+                                      &inner_begin, &inner_end)){
+            inner_begin = inner_end = last;
+        }
+        for(int x = begin; x < last; ++x){
+            if(x >= inner_begin && x < inner_end){
+                coverage[x - begin] = 0xff;
+                continue;
+            }
+            const qreal d = qSqrt(c.distance2(x + 0.5, py));
+            const qreal cover = qBound<qreal>(0, outer - d, 1);
+            coverage[x - begin] = uchar(qRound(cover * 255));
+        }
+        clearDabRow(scanLine(surface, y) + begin,
+                    coverage.constData(), last - begin);
+        dirty |= QRect(begin, y, last - begin, 1);
+    }
+    return dirty;
+}
+
+QRect stackCapsule(QImage *surface, const QPointF &start, const QPointF &end,
+                   qreal radius, qreal rim, quint32 color,
+                   qreal alpha, qreal spacing)
+{
+    Q_ASSERT(surface->format() == QImage::Format_ARGB32_Premultiplied);
+    return stackCapsuleAlpha(surface->size(), start, end, radius, rim,
+                             alpha, spacing,
+                             [surface, color](int x, int y, const uchar *alphas, int count){
+        coverDabRow(scanLine(surface, y) + x, color, alphas, count);
+    });
+}
+
+QRect stackCapsuleAlpha(const QSize &size, const QPointF &start, const QPointF &end,
+                        qreal radius, qreal rim, qreal alpha, qreal spacing,
+                        const CapsuleRowFunc &row)
+{
+    const Capsule c(start, end);
+    if(c.length2 <= 0 || spacing <= 0 || radius <= 0 || alpha <= 0){
+        return QRect();
+    }
+    rim = qBound<qreal>(0, rim, radius);
+
+    // alpha for every 1/STEPS of a dab, up to the most dabs that can
+    // cover one pixel, which is the chord through the dab's center.
+    // Values in between are interpolated.
+    const int STEPS = 8;
+    const int count = qBound(2, qCeil(2 * radius / spacing * STEPS) + 2, 4096);
+    QVarLengthArray<float, 512> alphas(count);
+    const qreal clear = alpha < 1 ? qLn(1 - alpha) : -1e9;
+    for(int i = 0; i < count; ++i){
+        alphas[i] = float((1 - qExp(clear * i / STEPS)) * 255);
+    }
+    const qreal per_pixel = STEPS / spacing;
+
+    // what a dab at t across the rim adds, as a share of a dab at full
+    // alpha: ln(1 - alpha * (1 - t)^4) / ln(1 - alpha)
+    const int RIM_STEPS = 32;
+    float weights[RIM_STEPS + 2];
+    const qreal rim_alpha = qMin<qreal>(alpha, 1 - 1e-6);
+    for(int i = 0; i <= RIM_STEPS; ++i){
+        qreal f = 1 - qreal(i) / RIM_STEPS;
+        f *= f;
+        f *= f;
+        weights[i] = float(qLn(1 - rim_alpha * f) / qLn(1 - rim_alpha));
+    }
+    weights[RIM_STEPS + 1] = 0;
+    const qreal inner = radius - rim;
+    const qreal inner2 = inner * inner;
+    const qreal to_rim = rim > 0 ? RIM_STEPS / rim : 0;
+    auto weight = [&](qreal h2, qreal w){
+        const qreal t = qBound<qreal>(0, (qSqrt(h2 + w * w) - inner) * to_rim,
+                                      RIM_STEPS);
+        const int i = int(t);
+        return weights[i] + (t - i) * (weights[i + 1] - weights[i]);
+    };
+    // integral of the weight for dabs centered from w0 to w1 along the
+    // segment, as offsets from the pixel h2 off it; four point
+    // Gauss-Legendre, the weight is smooth across the rim
+    auto rimCover = [&](qreal h2, qreal w0, qreal w1){
+        if(w1 <= w0){
+            return qreal(0);
+        }
+        const qreal mid = (w0 + w1) / 2;
+        const qreal half = (w1 - w0) / 2;
+        const qreal x0 = 0.3399810435848563 * half;
+        const qreal x1 = 0.8611363115940526 * half;
+        return half * (0.6521451548625461 * (weight(h2, mid - x0)
+                                             + weight(h2, mid + x0))
+                       + 0.3478548451374538 * (weight(h2, mid - x1)
+                                               + weight(h2, mid + x1)));
+    };
+    auto toAlpha = [&](qreal covered){
+        if(covered <= 0){
+            return 0.0f;
+        }
+        const qreal step = qMin(covered * per_pixel, qreal(count - 1));
+        const int i = qMin(int(step), count - 2);
+        return float(alphas[i] + (step - i) * (alphas[i + 1] - alphas[i]));
+    };
+
+    // Away from the ends of the segment, every dab that reaches a pixel
+    // lies on it, and the alpha only depends on how far off the segment
+    // the pixel is. It is tabulated every 1/PROFILE_STEPS pixel, along
+    // with what one side of the rim adds, which the ends reuse where
+    // they do not cut through the rim.
+    const int PROFILE_STEPS = 8;
+    const qreal radius2 = radius * radius;
+    const int profile_count = int(radius * PROFILE_STEPS) + 2;
+    QVarLengthArray<float, 512> profile(profile_count);
+    QVarLengthArray<float, 512> rims(profile_count);
+    for(int i = 0; i < profile_count; ++i){
+        const qreal h = qreal(i) / PROFILE_STEPS;
+        const qreal h2 = h * h;
+        const qreal outer = qSqrt(qMax<qreal>(0, radius2 - h2));
+        const qreal flat = h2 < inner2 ? qSqrt(inner2 - h2) : 0;
+        rims[i] = float(rimCover(h2, flat, outer));
+        profile[i] = h < radius ? toAlpha(2 * (flat + rims[i])) : 0;
+    }
+
+    const Bounds bounds = rowBounds(size, c, radius);
+    const qreal ux = c.dx / c.length;
+    const qreal uy = c.dy / c.length;
+    QVarLengthArray<uchar, 256> coverage;
+    QRect dirty;
+    for(int y = bounds.top; y <= bounds.bottom; ++y){
+        const qreal py = y + 0.5;
+        int begin, last;
+        if(!capsuleSpan(c, radius, py, bounds.width, &begin, &last)){
+            continue;
+        }
+        coverage.resize(last - begin);
+        const qreal ry = py - c.ay;
+        for(int x = begin; x < last; ++x){
+            const qreal rx = x + 0.5 - c.ax;
+            // s is along the segment and h the distance off it
+            const qreal s = rx * ux + ry * uy;
+            const qreal h = qAbs(ry * ux - rx * uy);
+            float f = 0;
+            if(h < radius){
+                const qreal t = h * PROFILE_STEPS;
+                const int i = qMin(int(t), profile_count - 2);
+                if(s >= radius && s <= c.length - radius){
+                    f = profile[i] + (t - i) * (profile[i + 1] - profile[i]);
+                }else{
+                    // dabs centered within the outer chord reach the
+                    // pixel, those within the inner one at full alpha,
+                    // and only those from -s to the end are on the segment
+                    const qreal h2 = h * h;
+                    const qreal outer = qSqrt(radius2 - h2);
+                    const qreal flat = h2 < inner2 ? qSqrt(inner2 - h2) : 0;
+                    const qreal w_begin = -s;
+                    const qreal w_end = c.length - s;
+                    qreal covered = qMax<qreal>(0, qMin(flat, w_end)
+                                                - qMax(-flat, w_begin));
+                    if(rim > 0){
+                        const qreal side = rims[i] + (t - i) * (rims[i + 1] - rims[i]);
+                        auto rimSide = [&](qreal w0, qreal w1){
+                            if(w1 <= w_begin || w0 >= w_end){
+                                return qreal(0);
+                            }
+                            if(w0 >= w_begin && w1 <= w_end){
+                                return side;
+                            }
+                            return rimCover(h2, qMax(w0, w_begin),
+                                            qMin(w1, w_end));
+                        };
+                        covered += rimSide(-outer, -flat) + rimSide(flat, outer);
+                    }
+                    f = toAlpha(covered);
+                }
+            }
+            coverage[x - begin] = uchar(f + 0.5f);
+        }
+        row(begin, y, coverage.constData(), last - begin);
+        dirty |= QRect(begin, y, last - begin, 1);
+    }
+    return dirty;
+}
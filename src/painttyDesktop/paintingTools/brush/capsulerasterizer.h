@@ -0,0 +1,44 @@
+#ifndef CAPSULERASTERIZER_H
+#define CAPSULERASTERIZER_H
+
+#include <QImage>
+#include <QPointF>
+#include <QRect>
+#include <functional>
+
+// Rasterizers for the area a round dab sweeps along a segment, a
+// capsule. Each computes the coverage of the capsule one scanline span
+// at a time and writes every pixel once, where stamping dabs writes the
+// same pixels over and over. Endpoints are in pixel corner coordinates,
+// the same as a dab's center, and surfaces are ARGB32_Premultiplied.
+// Each returns the part of the surface that was touched.
+
+// Hard edged capsule: pixels whose center lies within radius are
+// blended with the premultiplied color.
+QRect fillCapsule(QImage *surface, const QPointF &start, const QPointF &end,
+                  qreal radius, quint32 color);
+
+// Antialiased capsule that erases the surface.
+QRect clearCapsule(QImage *surface, const QPointF &start, const QPointF &end,
+                   qreal radius);
+
+// The result of stamping a round dab of opaque color every spacing
+// pixels along the segment, as the limit of infinitely many stamps.
+// The dab has the given alpha up to radius - rim from its center, and
+// fades out as (1 - t)^4 across the rim, which is the falloff of
+// BasicBrush at full hardness. A pixel that dabs along a length l of
+// the segment cover at full alpha gets 1 - (1 - alpha)^(l / spacing);
+// the rim counts in proportion to the alpha it adds.
+QRect stackCapsule(QImage *surface, const QPointF &start, const QPointF &end,
+                   qreal radius, qreal rim, quint32 color,
+                   qreal alpha, qreal spacing);
+
+// Computes the alpha of stackCapsule() on a surface of the given size
+// without writing it anywhere, and passes it on one span at a time,
+// starting at column x of row y.
+typedef std::function<void(int x, int y, const uchar *alpha, int count)> CapsuleRowFunc;
+QRect stackCapsuleAlpha(const QSize &size, const QPointF &start, const QPointF &end,
+                        qreal radius, qreal rim, qreal alpha, qreal spacing,
+                        const CapsuleRowFunc &row);
+
+#endif // CAPSULERASTERIZER_H
@@ -0,0 +1,385 @@
+#include "dabblitter.h"
+
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DAB_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(DAB_SSE2) && defined(__GNUC__) \
+    && (defined(__x86_64__) || defined(__i386__))
+#define DAB_AVX2
+#include <immintrin.h>
+#endif
+
+// All paths use the same arithmetic as Qt's raster engine:
+// dest = src + dest * (255 - alpha(src)) / 255, where the division is
+// (x + (x >> 8) + 0x80) >> 8 on every channel. That is what makes them
+// equivalent to QPainter::drawImage() in CompositionMode_SourceOver.
+
+static inline quint32 byteMul(quint32 x, quint32 a)
+{
+    quint32 t = (x & 0xff00ff) * a;
+    t = (t + ((t >> 8) & 0xff00ff) + 0x800080) >> 8;
+    t &= 0xff00ff;
+
+    x = ((x >> 8) & 0xff00ff) * a;
+    x = (x + ((x >> 8) & 0xff00ff) + 0x800080);
+    x &= 0xff00ff00;
+    return x | t;
+}
+
+static void blendRowGeneric(quint32 *dest, const quint32 *src, int count)
+{
+    for(int i = 0; i < count; ++i){
+        const quint32 s = src[i];
+        const quint32 alpha = s >> 24;
+        if(alpha == 0xff){
+            dest[i] = s;
+        }else if(alpha){
+            dest[i] = s + byteMul(dest[i], 0xff - alpha);
+        }
+    }
+}
+
+#ifdef DAB_SSE2
+static void blendRowSse2(quint32 *dest, const quint32 *src, int count)
+{
+    const __m128i rbMask = _mm_set1_epi32(0x00ff00ff);
+    const __m128i half = _mm_set1_epi16(0x80);
+    const __m128i full = _mm_set1_epi16(0xff);
+    const __m128i alphaMask = _mm_set1_epi32(0xff000000);
+
+    int i = 0;
+    for(; i + 4 <= count; i += 4){
+        const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        const __m128i alpha = _mm_and_si128(s, alphaMask);
+        // dabs are mostly transparent at their corners and opaque inside
+        if(_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, _mm_setzero_si128())) == 0xffff){
+            continue;
+        }
+        __m128i *d = reinterpret_cast<__m128i *>(dest + i);
+        if(_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, alphaMask)) == 0xffff){
+            _mm_storeu_si128(d, s);
+            continue;
+        }
+        __m128i a = _mm_srli_epi32(s, 24);
+        a = _mm_or_si128(a, _mm_slli_epi32(a, 16));
+        a = _mm_sub_epi16(full, a);
+
+        const __m128i dv = _mm_loadu_si128(d);
+        __m128i ag = _mm_srli_epi16(dv, 8);
+        __m128i rb = _mm_and_si128(dv, rbMask);
+        ag = _mm_mullo_epi16(ag, a);
+        rb = _mm_mullo_epi16(rb, a);
+        ag = _mm_add_epi16(_mm_add_epi16(ag, _mm_srli_epi16(ag, 8)), half);
+        rb = _mm_add_epi16(_mm_add_epi16(rb, _mm_srli_epi16(rb, 8)), half);
+        ag = _mm_andnot_si128(rbMask, ag);
+        rb = _mm_srli_epi16(rb, 8);
+        _mm_storeu_si128(d, _mm_add_epi8(s, _mm_or_si128(ag, rb)));
+    }
+    blendRowGeneric(dest + i, src + i, count - i);
+}
+#endif
+
+#ifdef DAB_AVX2
+__attribute__((target("avx2")))
+static void blendRowAvx2(quint32 *dest, const quint32 *src, int count)
+{
+    const __m256i rbMask = _mm256_set1_epi32(0x00ff00ff);
+    const __m256i half = _mm256_set1_epi16(0x80);
+    const __m256i full = _mm256_set1_epi16(0xff);
+    const __m256i alphaMask = _mm256_set1_epi32(int(0xff000000));
+
+    int i = 0;
+    for(; i + 8 <= count; i += 8){
+        const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        const __m256i alpha = _mm256_and_si256(s, alphaMask);
+        if(_mm256_testz_si256(s, alphaMask)){
+            continue;
+        }
+        __m256i *d = reinterpret_cast<__m256i *>(dest + i);
+        if(_mm256_movemask_epi8(_mm256_cmpeq_epi32(alpha, alphaMask)) == -1){
+            _mm256_storeu_si256(d, s);
+            continue;
+        }
+        __m256i a = _mm256_srli_epi32(s, 24);
+        a = _mm256_or_si256(a, _mm256_slli_epi32(a, 16));
+        a = _mm256_sub_epi16(full, a);
+
+        const __m256i dv = _mm256_loadu_si256(d);
+        __m256i ag = _mm256_srli_epi16(dv, 8);
+        __m256i rb = _mm256_and_si256(dv, rbMask);
+        ag = _mm256_mullo_epi16(ag, a);
+        rb = _mm256_mullo_epi16(rb, a);
+        ag = _mm256_add_epi16(_mm256_add_epi16(ag, _mm256_srli_epi16(ag, 8)), half);
+        rb = _mm256_add_epi16(_mm256_add_epi16(rb, _mm256_srli_epi16(rb, 8)), half);
+        ag = _mm256_andnot_si256(rbMask, ag);
+        rb = _mm256_srli_epi16(rb, 8);
+        _mm256_storeu_si256(d, _mm256_add_epi8(s, _mm256_or_si256(ag, rb)));
+    }
+    // clear the upper halves of the registers before going back to SSE,
+    // which the compiler does not always do on its own; otherwise every
+    // SSE instruction after a dab pays for the switch
+    _mm256_zeroupper();
+    blendRowSse2(dest + i, src + i, count - i);
+}
+#endif
+
+void fillDabRow(quint32 *dest, quint32 color, int count)
+{
+    const quint32 alpha = color >> 24;
+    if(alpha == 0xff){
+        for(int i = 0; i < count; ++i){
+            dest[i] = color;
+        }
+    }else if(alpha){
+        for(int i = 0; i < count; ++i){
+            dest[i] = color + byteMul(dest[i], 0xff - alpha);
+        }
+    }
+}
+
+void coverDabRow(quint32 *dest, quint32 color,
+                 const uchar *coverage, int count)
+{
+    for(int i = 0; i < count; ++i){
+        const quint32 c = coverage[i];
+        if(!c){
+            continue;
+        }
+        const quint32 s = c == 0xff ? color : byteMul(color, c);
+        const quint32 alpha = s >> 24;
+        dest[i] = alpha == 0xff ? s : s + byteMul(dest[i], 0xff - alpha);
+    }
+}
+
+void tintDabRow(quint32 *dest, quint32 color, const uchar *alpha, int count)
+{
+    for(int i = 0; i < count; ++i){
+        dest[i] = byteMul(color, alpha[i]);
+    }
+}
+
+void clearDabRow(quint32 *dest, const uchar *coverage, int count)
+{
+    for(int i = 0; i < count; ++i){
+        const quint32 c = coverage[i];
+        if(c == 0xff){
+            dest[i] = 0;
+        }else if(c){
+            dest[i] = byteMul(dest[i], 0xff - c);
+        }
+    }
+}
+
+// x / 255 rounded down, exact for x < 65535
+static inline quint32 div255(quint32 x)
+{
+    return (x + 1 + (x >> 8)) >> 8;
+}
+
+static void maskRowGeneric(quint32 *dest, const quint32 *src,
+                           const uchar *mask, int count)
+{
+    for(int i = 0; i < count; ++i){
+        const quint32 s = src[i];
+        const quint32 alpha = div255((s >> 24) * mask[i]);
+        dest[i] = (byteMul(s, alpha) & 0x00ffffff) | (alpha << 24);
+    }
+}
+
+#ifdef DAB_SSE2
+static void maskRowSse2(quint32 *dest, const quint32 *src,
+                        const uchar *mask, int count)
+{
+    const __m128i rbMask = _mm_set1_epi32(0x00ff00ff);
+    const __m128i gMask = _mm_set1_epi32(0x0000ff00);
+    const __m128i half = _mm_set1_epi16(0x80);
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i zero = _mm_setzero_si128();
+
+    int i = 0;
+    for(; i + 4 <= count; i += 4){
+        const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        quint32 m4;
+        memcpy(&m4, mask + i, 4);
+        // one mask byte per 32 bit lane
+        const __m128i m = _mm_unpacklo_epi16(
+                    _mm_unpacklo_epi8(_mm_cvtsi32_si128(int(m4)), zero), zero);
+        __m128i a = _mm_mullo_epi16(_mm_srli_epi32(s, 24), m);
+        a = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(a, one),
+                                         _mm_srli_epi16(a, 8)), 8);
+        const __m128i a2 = _mm_or_si128(a, _mm_slli_epi32(a, 16));
+
+        __m128i rb = _mm_mullo_epi16(_mm_and_si128(s, rbMask), a2);
+        __m128i g = _mm_mullo_epi16(_mm_and_si128(_mm_srli_epi32(s, 8), rbMask), a2);
+        rb = _mm_add_epi16(_mm_add_epi16(rb, _mm_srli_epi16(rb, 8)), half);
+        g = _mm_add_epi16(_mm_add_epi16(g, _mm_srli_epi16(g, 8)), half);
+        rb = _mm_srli_epi16(rb, 8);
+        g = _mm_and_si128(g, gMask);
+        const __m128i out = _mm_or_si128(_mm_or_si128(rb, g), _mm_slli_epi32(a, 24));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + i), out);
+    }
+    maskRowGeneric(dest + i, src + i, mask + i, count - i);
+}
+#endif
+
+void maskDabRow(quint32 *dest, const quint32 *src,
+                const uchar *mask, int count)
+{
+#ifdef DAB_SSE2
+    maskRowSse2(dest, src, mask, count);
+#else
+    maskRowGeneric(dest, src, mask, count);
+#endif
+}
+
+static int sumRowGeneric(const quint32 *src, int count, quint32 sums[4])
+{
+    int colored = 0;
+    for(int i = 0; i < count; ++i){
+        const quint32 s = src[i];
+        const quint32 a = s >> 24;
+        if(!a){
+            continue;
+        }
+        sums[0] += (s & 0xff) * 255 / a;
+        sums[1] += ((s >> 8) & 0xff) * 255 / a;
+        sums[2] += ((s >> 16) & 0xff) * 255 / a;
+        sums[3] += a;
+        ++colored;
+    }
+    return colored;
+}
+
+#ifdef DAB_SSE2
+// c * 255 fits a float exactly, and a correctly rounded quotient never
+// reaches the next integer unless the exact one does, as that is at
+// least 1/255 away. So truncating it equals the integer division.
+static inline __m128i unpremultiplySse2(__m128i channel, __m128 alpha,
+                                        __m128i colored)
+{
+    const __m128 c = _mm_cvtepi32_ps(_mm_mullo_epi16(channel, _mm_set1_epi32(255)));
+    return _mm_and_si128(_mm_cvttps_epi32(_mm_div_ps(c, alpha)), colored);
+}
+
+static int sumRowSse2(const quint32 *src, int count, quint32 sums[4])
+{
+    const __m128i byteMask = _mm_set1_epi32(0xff);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i b = zero;
+    __m128i g = zero;
+    __m128i r = zero;
+    __m128i a = zero;
+    // counts down by one for every colored pixel
+    __m128i transparent = zero;
+
+    int i = 0;
+    for(; i + 4 <= count; i += 4){
+        const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        const __m128i alpha = _mm_srli_epi32(s, 24);
+        const __m128i empty = _mm_cmpeq_epi32(alpha, zero);
+        const __m128i colored = _mm_xor_si128(empty, _mm_set1_epi32(-1));
+        // transparent lanes divide by one, and are masked out anyway
+        const __m128 divisor = _mm_cvtepi32_ps(_mm_or_si128(alpha,
+                                                            _mm_srli_epi32(empty, 31)));
+        b = _mm_add_epi32(b, unpremultiplySse2(_mm_and_si128(s, byteMask),
+                                               divisor, colored));
+        g = _mm_add_epi32(g, unpremultiplySse2(_mm_and_si128(_mm_srli_epi32(s, 8), byteMask),
+                                               divisor, colored));
+        r = _mm_add_epi32(r, unpremultiplySse2(_mm_and_si128(_mm_srli_epi32(s, 16), byteMask),
+                                               divisor, colored));
+        a = _mm_add_epi32(a, alpha);
+        transparent = _mm_sub_epi32(transparent, empty);
+    }
+
+    quint32 lanes[4][4];
+    quint32 empty[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes[0]), b);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes[1]), g);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes[2]), r);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes[3]), a);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(empty), transparent);
+    for(int c = 0; c < 4; ++c){
+        sums[c] += lanes[c][0] + lanes[c][1] + lanes[c][2] + lanes[c][3];
+    }
+    const int colored = i - int(empty[0] + empty[1] + empty[2] + empty[3]);
+    return colored + sumRowGeneric(src + i, count - i, sums);
+}
+#endif
+
+int sumPixelRow(const quint32 *src, int count, quint32 sums[4])
+{
+#ifdef DAB_SSE2
+    return sumRowSse2(src, count, sums);
+#else
+    return sumRowGeneric(src, count, sums);
+#endif
+}
+
+typedef void (*BlendRowFunc)(quint32 *, const quint32 *, int);
+
+static BlendRowFunc pickBlendRow()
+{
+#ifdef DAB_AVX2
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")){
+        return blendRowAvx2;
+    }
+#endif
+#ifdef DAB_SSE2
+    return blendRowSse2;
+#else
+    return blendRowGeneric;
+#endif
+}
+
+void blendDabRow(quint32 *dest, const quint32 *src, int count)
+{
+    static const BlendRowFunc blendRow = pickBlendRow();
+    blendRow(dest, src, count);
+}
+
+QRect blendDab(QImage *surface, const QImage &stencil, const QPoint &pos)
+{
+    if(stencil.isNull()){
+        return QRect();
+    }
+    Q_ASSERT(surface->format() == QImage::Format_ARGB32_Premultiplied);
+    Q_ASSERT(stencil.format() == QImage::Format_ARGB32_Premultiplied);
+
+    const QRect area = QRect(pos, stencil.size()).intersected(surface->rect());
+    if(area.isEmpty()){
+        return QRect();
+    }
+    const int sx = area.x() - pos.x();
+    const int sy = area.y() - pos.y();
+    const int bpl = surface->bytesPerLine();
+    uchar *bits = surface->bits() + area.y() * bpl + area.x() * 4;
+    for(int y = 0; y < area.height(); ++y){
+        const quint32 *src = reinterpret_cast<const quint32 *>(
+                    stencil.constScanLine(sy + y)) + sx;
+        blendDabRow(reinterpret_cast<quint32 *>(bits + y * bpl),
+                    src, area.width());
+    }
+    return area;
+}
+
+QRect blendDabInside(uchar *bits, int bytesPerLine,
+                     const QImage &stencil, const QPoint &pos)
+{
+    Q_ASSERT(stencil.format() == QImage::Format_ARGB32_Premultiplied);
+    const int width = stencil.width();
+    const int height = stencil.height();
+    const int stride = stencil.bytesPerLine();
+    const uchar *src = stencil.constBits();
+    uchar *dest = bits + pos.y() * bytesPerLine + pos.x() * 4;
+    for(int y = 0; y < height; ++y){
+        blendDabRow(reinterpret_cast<quint32 *>(dest + y * bytesPerLine),
+                    reinterpret_cast<const quint32 *>(src + y * stride),
+                    width);
+    }
+    return QRect(pos, stencil.size());
+}
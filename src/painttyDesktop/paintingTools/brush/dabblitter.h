@@ -0,0 +1,52 @@
+#ifndef DABBLITTER_H
+#define DABBLITTER_H
+
+#include <QImage>
+#include <QPoint>
+#include <QRect>
+
+// Composites a premultiplied dab onto a premultiplied surface with
+// source-over, without a QPainter. Results match QPainter::drawImage()
+// at an integer offset bit for bit, and the widest SIMD path the CPU
+// supports is picked once at runtime.
+// Returns the part of the surface that was touched.
+QRect blendDab(QImage *surface, const QImage &stencil, const QPoint &pos);
+
+// blendDab() for a dab known to lie fully inside the surface, whose
+// bits and bytes per line the caller looked up once, for example once
+// per segment. Nothing is clipped.
+QRect blendDabInside(uchar *bits, int bytesPerLine,
+                     const QImage &stencil, const QPoint &pos);
+
+// Row kernel used by blendDab(), blends count pixels of src over dest.
+void blendDabRow(quint32 *dest, const quint32 *src, int count);
+
+// Blends the premultiplied color over count pixels of dest.
+void fillDabRow(quint32 *dest, quint32 color, int count);
+
+// Blends the premultiplied color, scaled by coverage, over count
+// pixels of dest.
+void coverDabRow(quint32 *dest, quint32 color,
+                 const uchar *coverage, int count);
+
+// Writes the premultiplied color scaled by alpha into count pixels of
+// dest, which is how stencils are colored from an alpha mask.
+void tintDabRow(quint32 *dest, quint32 color, const uchar *alpha, int count);
+
+// Erases count pixels of dest by coverage, like a transparent source
+// in CompositionMode_Clear painted with that much antialiasing.
+void clearDabRow(quint32 *dest, const uchar *coverage, int count);
+
+// Scales the alpha of count straight (not premultiplied) ARGB32 pixels
+// of src by mask, and writes them premultiplied into dest. Gives the
+// same result as qPremultiply(qRgba(r, g, b, a * mask / 255)).
+void maskDabRow(quint32 *dest, const quint32 *src,
+                const uchar *mask, int count);
+
+// Adds the straight channels of count premultiplied pixels of src to
+// sums, in the order blue, green, red, alpha. Colors are unpremultiplied
+// as c * 255 / alpha, truncated, and fully transparent pixels add
+// nothing. Returns how many of the pixels are not fully transparent.
+int sumPixelRow(const quint32 *src, int count, quint32 sums[4]);
+
+#endif // DABBLITTER_H
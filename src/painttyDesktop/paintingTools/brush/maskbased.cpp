@@ -2,12 +2,14 @@
 #include <QPainter>
 #include <QDebug>
 
+#include "dabblitter.h"
 #include "../../misc/shortcutmanager.h"
 #include "../../misc/singleton.h"
 
 MaskBased::MaskBased() :
     BasicBrush()
 {
+    wash_strokes_ = false;
     typedef BrushFeature BF;
     BF::FeatureBits bits;
     bits.set(BF::WIDTH);
@@ -20,73 +22,166 @@ MaskBased::MaskBased() :
     displayName_ = QObject::tr("Crayon");
     shortcut_ = Singleton<ShortcutManager>::instance()
             .shortcut("crayon")["key"].toString();
-    this->setMask(QImage(":/iconset/canvas-print.png"));
+    // every crayon shares the decoded texture
+    plane_ = sharedPlane(":/iconset/canvas-print.png");
+    updateStencil();
     icon_ = QIcon(":/iconset/ui/brush/crayon.png");
 }
 
+/*!
+    \fn MaskBased::MaskPlanePointer MaskBased::makePlane(const QImage &mask)
+
+    Extracts the alpha plane of \a mask. Returns null if \a mask is null.
+*/
+
+MaskBased::MaskPlanePointer MaskBased::makePlane(const QImage &mask)
+{
+    if(mask.isNull()){
+        return MaskPlanePointer();
+    }
+    QSharedPointer<MaskPlane> plane(new MaskPlane);
+    plane->image = mask.convertToFormat(QImage::Format_ARGB32);
+    plane->width = plane->image.width();
+    plane->height = plane->image.height();
+    plane->alpha.resize(plane->width * 2 * plane->height);
+    uchar *dest = plane->alpha.data();
+    for(int y = 0; y < plane->height; ++y){
+        const QRgb *line = reinterpret_cast<const QRgb *>(plane->image.constScanLine(y));
+        for(int x = 0; x < plane->width * 2; ++x){
+            *dest++ = qAlpha(line[x % plane->width]);
+        }
+    }
+    return plane;
+}
+
+/*!
+    \fn MaskBased::MaskPlanePointer MaskBased::sharedPlane(const QString &path)
+
+    Returns the plane of the mask image at \a path. Each path is decoded
+    once, and the plane is shared by all brushes that use it.
+*/
+
+MaskBased::MaskPlanePointer MaskBased::sharedPlane(const QString &path)
+{
+    static QHash<QString, MaskPlanePointer> planes;
+    auto it = planes.constFind(path);
+    if(it != planes.constEnd()){
+        return it.value();
+    }
+    MaskPlanePointer plane = makePlane(QImage(path));
+    if(plane.isNull()){
+        qDebug()<<"null mask";
+    }
+    planes.insert(path, plane);
+    return plane;
+}
+
 void MaskBased::makeStencil(QColor color)
 {
     BasicBrush::makeStencil(color);
-    if(mask_.isNull()){
-        return;
+}
+
+const QImage &MaskBased::straightStencil(const QImage &stencil)
+{
+    auto it = straight_.find(stencil.cacheKey());
+    if(it == straight_.end()){
+        // stencils of an old color are never asked for again
+        if(straight_.size() > PRESSURE_LEVELS * 2){
+            straight_.clear();
+        }
+        it = straight_.insert(stencil.cacheKey(),
+                              stencil.convertToFormat(QImage::Format_ARGB32));
     }
+    return it.value();
 }
 
-void MaskBased::drawPointInternal(const QPoint &p, const QImage &stencil, QPainter *painter)
+void MaskBased::drawPointInternal(const QPoint &p, const QImage &stencil, QImage *surface)
 {
-    QImage copied_stencil = stencil.convertToFormat(QImage::Format_ARGB32);
-    bool need_delete = false;
-    if(!painter) {
-        painter = new QPainter;
-        need_delete = true;
-        painter->setRenderHint(QPainter::Antialiasing);
-        painter->begin(surface_->imagePtr());
-//        painter->setOpacity(thickness_/qreal(BrushFeature::LIMIT::THICKNESS_MAX));
+    if(!plane_ || stencil.isNull()){
+        return;
     }
+    addDirtyRect(maskDab(p, straightStencil(stencil), surface));
+}
 
-    int lineLength = copied_stencil.width();
-    QRgb * data = (QRgb *)copied_stencil.bits();
-    int mask_start_x = (p.x()+mask_.width()) % mask_.width();
-    int mask_start_y = (p.y()+mask_.height()) % mask_.height();
-
-    for(int y = 0; y<copied_stencil.height();++y){
-        for(int x = 0; x<lineLength;++x) {
-            int mask_x = (mask_start_x + x) % mask_.width();
-            int mask_y = (mask_start_y + y) % mask_.height();
-            auto p = data[y*lineLength+x];
-            data[y*lineLength+x] = qRgba(
-                        qRed(p),
-                        qGreen(p),
-                        qBlue(p),
-                        qAlpha(p)*qAlpha(mask_.pixel(mask_x, mask_y))/255);
-        }
+// the stencil is looked up once for the whole segment
+void MaskBased::drawDabs(const QPoint &start, const QPoint &end,
+                         qreal spacing, const QImage &stencil,
+                         QImage *surface)
+{
+    if(!plane_ || stencil.isNull()){
+        return;
     }
+    const QImage &source = straightStencil(stencil);
+    stampLine(start, end, spacing, source.size(),
+              [&](const QPoint &p){
+        addDirtyRect(maskDab(p, source, surface));
+    });
+}
 
-    painter->drawImage(p.x(), p.y(), copied_stencil);
+// blends source, a stencil with straight alpha, through the mask at p
+QRect MaskBased::maskDab(const QPoint &p, const QImage &source, QImage *surface)
+{
+    const QRect area = QRect(p, source.size()).intersected(surface->rect());
+    if(area.isEmpty()){
+        return QRect();
+    }
+    const int w = plane_->width;
+    const int h = plane_->height;
+    // the mask is anchored to the canvas, not to the dab
+    const int mask_x = ((area.x() % w) + w) % w;
+    int mask_y = ((area.y() % h) + h) % h;
+    const int sx = area.x() - p.x();
+    const int sy = area.y() - p.y();
+    if(row_.size() < area.width()){
+        row_.resize(area.width());
+    }
+    quint32 *row = row_.data();
 
-    if(need_delete) {
-        painter->end();
-        delete painter;
+    const int bpl = surface->bytesPerLine();
+    uchar *bits = surface->bits() + area.y() * bpl + area.x() * 4;
+    for(int y = 0; y < area.height(); ++y){
+        const quint32 *src = reinterpret_cast<const quint32 *>(
+                    source.constScanLine(sy + y)) + sx;
+        const uchar *mask = plane_->row(mask_y);
+        // spans wider than the mask are split where it repeats
+        for(int x = 0, mx = mask_x; x < area.width(); ){
+            const int n = qMin(area.width() - x, w);
+            maskDabRow(row + x, src + x, mask + mx, n);
+            x += n;
+            mx = (mx + n) % w;
+        }
+        blendDabRow(reinterpret_cast<quint32 *>(bits + y * bpl),
+                    row, area.width());
+        if(++mask_y == h){
+            mask_y = 0;
+        }
     }
+    return area;
+}
+
+// the texture differs from dab to dab, so it cannot be swept
+bool MaskBased::drawCapsule(const QPoint &, const QPoint &, qreal, QImage *)
+{
+    return false;
 }
+
 QImage MaskBased::mask() const
 {
-    return mask_;
+    return plane_ ? plane_->image : QImage();
 }
 
 void MaskBased::setMask(const QImage &mask)
 {
-    if(mask.isNull()){
+    MaskPlanePointer plane = makePlane(mask);
+    if(plane.isNull()){
         qDebug()<<"null mask";
         return;
     }
-    mask_ = mask.convertToFormat(QImage::Format_ARGB32);
-    makeStencil(color_);
+    plane_ = plane;
+    updateStencil();
 }
 
 AbstractBrush *MaskBased::createBrush()
 {
     return new MaskBased;
 }
-
-
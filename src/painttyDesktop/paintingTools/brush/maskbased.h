@@ -2,6 +2,9 @@
 #define MASKBASED_H
 
 #include "basicbrush.h"
+#include <QVector>
+#include <QHash>
+#include <QSharedPointer>
 
 class MaskBased : public BasicBrush
 {
@@ -16,11 +19,35 @@ signals:
 
 public slots:
 protected:
+    // alpha of the mask, with each row stored twice over, so a span
+    // as wide as the mask can be read from any offset without wrapping
+    struct MaskPlane
+    {
+        QImage image;
+        int width;
+        int height;
+        QVector<uchar> alpha;
+        const uchar *row(int y) const {return alpha.constData() + y * width * 2;}
+    };
+    typedef QSharedPointer<const MaskPlane> MaskPlanePointer;
+    static MaskPlanePointer makePlane(const QImage &mask);
+    static MaskPlanePointer sharedPlane(const QString &path);
+
     void makeStencil(QColor color) Q_DECL_OVERRIDE;
     void drawPointInternal(const QPoint& p,
                            const QImage &stencil,
-                           QPainter *painter) Q_DECL_OVERRIDE;
-    QImage mask_;
+                           QImage *surface) Q_DECL_OVERRIDE;
+    void drawDabs(const QPoint &start, const QPoint &end, qreal spacing,
+                  const QImage &stencil, QImage *surface) Q_DECL_OVERRIDE;
+    QRect maskDab(const QPoint &p, const QImage &source, QImage *surface);
+    bool drawCapsule(const QPoint &start, const QPoint &end,
+                     qreal pressure, QImage *surface) Q_DECL_OVERRIDE;
+    const QImage &straightStencil(const QImage &stencil);
+    MaskPlanePointer plane_;
+    // stencils with straight alpha, keyed by the premultiplied
+    // stencil, so each pressure level is converted only once
+    QHash<qint64, QImage> straight_;
+    QVector<quint32> row_;
 };
 
 #endif // MASKBASED_H
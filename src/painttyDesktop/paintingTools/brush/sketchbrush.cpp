@@ -5,7 +5,9 @@
 #include "../../misc/shortcutmanager.h"
 #include "../../misc/singleton.h"
 
-SketchBrush::SketchBrush()
+SketchBrush::SketchBrush():
+    head_(0),
+    count_(0)
 {
     typedef BrushFeature BF;
     BF::FeatureBits bits;
@@ -30,8 +32,9 @@ void SketchBrush::setColor(const QColor &c)
 void SketchBrush::drawPoint(const QPoint &p, qreal )
 {
 //    preparePen();
-    points.clear();
-    points.push_back(p);
+    head_ = 0;
+    count_ = 0;
+    pushPoint(p);
     last_point_ = p;
 }
 
@@ -41,11 +44,22 @@ void SketchBrush::drawLineTo(const QPoint &end, qreal pressure)
         drawPoint(end, pressure);
         return;
     }
-    points.push_back(end);
+    pushPoint(end);
     sketch();
     last_point_ = end;
 }
 
+QRect SketchBrush::affectedRect(const QPoint &end) const
+{
+    // the curve stays inside the hull of its control points
+    QRect rect(end, end);
+    for(int i = 0; i < count_; ++i){
+        rect |= QRect(point(i), point(i));
+    }
+    const int rad = (width_ >> 1) + 2;
+    return rect.adjusted(-rad, -rad, rad, rad);
+}
+
 AbstractBrush *SketchBrush::createBrush()
 {
     return new SketchBrush;
@@ -67,24 +81,57 @@ void SketchBrush::preparePen()
     sketchPen.setJoinStyle(Qt::RoundJoin);
 }
 
+const QPoint &SketchBrush::point(int i) const
+{
+    return points_[(head_ + i) % WINDOW];
+}
+
+void SketchBrush::pushPoint(const QPoint &p)
+{
+    if(count_ == WINDOW){
+        head_ = (head_ + 1) % WINDOW;
+        --count_;
+    }
+    points_[(head_ + count_) % WINDOW] = p;
+    ++count_;
+}
+
+/*!
+    \fn void SketchBrush::sketch()
+
+    Strokes one curve through the oldest points of a full window,
+    then drops the oldest point. The overlapping curves make up the
+    sketchy look, and each call costs the same however long the
+    stroke gets.
+*/
+
 void SketchBrush::sketch()
 {
-    if(points.count() > 10){
-        QPainterPath path;
-        path.moveTo(points[0]);
-        for(int i=0;i<points.count()-10;i+=4){
-            path.cubicTo(points[i], points[i+2], points[i+9]);
-        }
-        points.pop_front();
-
-        QPainter painter;
-        if(!painter.begin(surface_->imagePtr())){
-            return;
-        }
-        painter.setRenderHint(QPainter::Antialiasing);
-        painter.strokePath(path, sketchPen);
-        painter.end();
+    if(count_ < WINDOW){
+        return;
+    }
+    const QPoint start = point(0);
+    const QPoint control = point(2);
+    const QPoint end = point(9);
+    head_ = (head_ + 1) % WINDOW;
+    --count_;
+
+    QPainterPath path(start);
+    path.cubicTo(start, control, end);
+
+    QPainter painter;
+    if(!painter.begin(surface_->imagePtr())){
+        return;
     }
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.strokePath(path, sketchPen);
+    painter.end();
+    surface_->markModified();
+    const int rad = (sketchPen.width() >> 1) + 1;
+    QRect rect(start, start);
+    rect |= QRect(control, control);
+    rect |= QRect(end, end);
+    addDirtyRect(rect.adjusted(-rad, -rad, rad, rad));
 }
 
 BrushSettings SketchBrush::defaultSettings() const
@@ -2,7 +2,6 @@
 #define SKETCHBRUSH_H
 
 #include "abstractbrush.h"
-#include <QList>
 #include <QPen>
 
 class SketchBrush : public AbstractBrush
@@ -12,13 +11,24 @@ public:
     void setColor(const QColor& c) Q_DECL_OVERRIDE;
     void drawPoint(const QPoint& p, qreal pressure=1) Q_DECL_OVERRIDE;
     void drawLineTo(const QPoint& end, qreal pressure=1) Q_DECL_OVERRIDE;
+    QRect affectedRect(const QPoint& end) const Q_DECL_OVERRIDE;
     AbstractBrush* createBrush() Q_DECL_OVERRIDE;
     void setSettings(const BrushSettings &settings) Q_DECL_OVERRIDE;
     BrushSettings defaultSettings() const Q_DECL_OVERRIDE;
 protected:
+    enum : int {
+        // each curve spans this many of the latest points
+        WINDOW = 11
+    };
+
     void preparePen();
     QPen sketchPen;
-    QList<QPoint> points;
+    // ring buffer of the latest points
+    QPoint points_[WINDOW];
+    int head_;
+    int count_;
+    const QPoint &point(int i) const;
+    void pushPoint(const QPoint &p);
     void sketch();
 };
 
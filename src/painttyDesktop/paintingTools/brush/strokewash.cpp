@@ -0,0 +1,183 @@
+#include "strokewash.h"
+#include "dabblitter.h"
+
+/*!
+    \class StrokeWash
+
+    \brief Collects the alpha of one stroke, and writes it into the
+    surface in one go.
+
+    Dabs are not blended into the surface. Their alpha builds up in a
+    plane of their own, limited to the opacity cap of the stroke, so a
+    stroke never gets more opaque than its thickness allows, wherever it
+    overlaps itself. flush() then blends only the alpha gained since
+    the last flush into the surface, once per pixel.
+
+    The planes are kept in tiles of TILE_SIZE, allocated as the stroke
+    reaches them. A stroke that paints the surface with alpha A over
+    flushes still yields the surface under it blended with the color at
+    alpha A, because each flush blends (A1 - A0) / (1 - A0) over what the
+    previous flushes left.
+*/
+
+static const int TILE_PIXELS = StrokeWash::TILE_SIZE * StrokeWash::TILE_SIZE;
+
+StrokeWash::StrokeWash()
+    :color_(0),
+      cap_(0),
+      columns_(0)
+{
+}
+
+/*!
+    \fn void StrokeWash::begin(const QSize &size, QRgb color, int cap)
+
+    Starts a stroke of \a color on a surface of \a size, with alpha
+    limited to \a cap, from 0 to 255. The alpha of \a color is ignored.
+*/
+
+void StrokeWash::begin(const QSize &size, QRgb color, int cap)
+{
+    end();
+    size_ = size;
+    color_ = color | 0xff000000;
+    cap_ = qBound(0, cap, 255);
+    columns_ = (size.width() + TILE_SIZE - 1) / TILE_SIZE;
+    const int rows = (size.height() + TILE_SIZE - 1) / TILE_SIZE;
+    tiles_.resize(columns_ * rows);
+}
+
+void StrokeWash::end()
+{
+    tiles_.clear();
+    pending_ = QRect();
+    size_ = QSize();
+    columns_ = 0;
+}
+
+bool StrokeWash::isActive() const
+{
+    return !tiles_.isEmpty();
+}
+
+// whether the stroke gained anything since the last flush
+bool StrokeWash::hasPending() const
+{
+    return !pending_.isEmpty();
+}
+
+uchar *StrokeWash::tile(int tx, int ty)
+{
+    QByteArray &t = tiles_[ty * columns_ + tx];
+    if(t.isEmpty()){
+        t = QByteArray(TILE_PIXELS * 2, 0);
+    }
+    return reinterpret_cast<uchar *>(t.data());
+}
+
+/*!
+    \fn QRect StrokeWash::addDab(const QImage &stencil, const QPoint &pos)
+
+    Adds the alpha of \a stencil, placed at \a pos. Returns the part of
+    the surface it reaches.
+*/
+
+QRect StrokeWash::addDab(const QImage &stencil, const QPoint &pos)
+{
+    const QRect area = QRect(pos, stencil.size())
+            .intersected(QRect(QPoint(0, 0), size_));
+    if(area.isEmpty()){
+        return QRect();
+    }
+    if(row_.size() < area.width()){
+        row_.resize(area.width());
+    }
+    uchar *alpha = row_.data();
+    const int sx = area.x() - pos.x();
+    for(int y = area.top(); y <= area.bottom(); ++y){
+        const QRgb *src = reinterpret_cast<const QRgb *>(
+                    stencil.constScanLine(y - pos.y())) + sx;
+        for(int x = 0; x < area.width(); ++x){
+            alpha[x] = qAlpha(src[x]);
+        }
+        addRow(area.x(), y, alpha, area.width());
+    }
+    return area;
+}
+
+/*!
+    \fn void StrokeWash::addRow(int x, int y, const uchar *alpha, int count)
+
+    Adds \a count values of \a alpha to row \a y, from column \a x on.
+    The row must lie inside the surface.
+*/
+
+void StrokeWash::addRow(int x, int y, const uchar *alpha, int count)
+{
+    pending_ |= QRect(x, y, count, 1);
+    const int ty = y / TILE_SIZE;
+    const int line = (y % TILE_SIZE) * TILE_SIZE;
+    while(count > 0){
+        const int offset = x % TILE_SIZE;
+        const int n = qMin(count, TILE_SIZE - offset);
+        uchar *wash = tile(x / TILE_SIZE, ty) + line + offset;
+        for(int i = 0; i < n; ++i){
+            const int a = alpha[i];
+            const int w = wash[i];
+            // source over, on alpha alone
+            wash[i] = uchar(qMin(cap_, w + a - (w * a + 127) / 255));
+        }
+        x += n;
+        alpha += n;
+        count -= n;
+    }
+}
+
+/*!
+    \fn QRect StrokeWash::flush(QImage *surface)
+
+    Blends what the stroke gained since the last call into \a surface.
+    Returns the part of \a surface that changed.
+*/
+
+QRect StrokeWash::flush(QImage *surface)
+{
+    const QRect area = pending_.intersected(surface->rect());
+    pending_ = QRect();
+    if(!isActive() || area.isEmpty()){
+        return QRect();
+    }
+    Q_ASSERT(surface->format() == QImage::Format_ARGB32_Premultiplied);
+    if(row_.size() < TILE_SIZE){
+        row_.resize(TILE_SIZE);
+    }
+    uchar *coverage = row_.data();
+    for(int y = area.top(); y <= area.bottom(); ++y){
+        const int ty = y / TILE_SIZE;
+        const int line = (y % TILE_SIZE) * TILE_SIZE;
+        quint32 *dest = reinterpret_cast<quint32 *>(surface->scanLine(y));
+        for(int x = area.left(); x <= area.right(); ){
+            const int offset = x % TILE_SIZE;
+            const int n = qMin(area.right() + 1 - x, TILE_SIZE - offset);
+            QByteArray &t = tiles_[ty * columns_ + x / TILE_SIZE];
+            if(!t.isEmpty()){
+                uchar *wash = reinterpret_cast<uchar *>(t.data()) + line + offset;
+                uchar *applied = wash + TILE_PIXELS;
+                for(int i = 0; i < n; ++i){
+                    const int a1 = wash[i];
+                    const int a0 = applied[i];
+                    if(a1 > a0){
+                        coverage[i] = uchar(((a1 - a0) * 255 + (255 - a0) / 2)
+                                            / (255 - a0));
+                        applied[i] = uchar(a1);
+                    }else{
+                        coverage[i] = 0;
+                    }
+                }
+                coverDabRow(dest + x, color_, coverage, n);
+            }
+            x += n;
+        }
+    }
+    return area;
+}
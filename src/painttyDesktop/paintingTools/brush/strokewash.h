@@ -0,0 +1,38 @@
+#ifndef STROKEWASH_H
+#define STROKEWASH_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QRect>
+#include <QVector>
+
+class StrokeWash
+{
+public:
+    enum : int {
+        TILE_SIZE = 64
+    };
+
+    StrokeWash();
+    void begin(const QSize &size, QRgb color, int cap);
+    void end();
+    bool isActive() const;
+    bool hasPending() const;
+    QRect addDab(const QImage &stencil, const QPoint &pos);
+    void addRow(int x, int y, const uchar *alpha, int count);
+    QRect flush(QImage *surface);
+
+private:
+    QSize size_;
+    quint32 color_;
+    int cap_;
+    int columns_;
+    // per tile the alpha of the stroke, then the alpha already
+    // written to the surface; empty until the stroke touches it
+    QVector<QByteArray> tiles_;
+    QRect pending_;
+    QVector<uchar> row_;
+    uchar *tile(int tx, int ty);
+};
+
+#endif // STROKEWASH_H
@@ -1,14 +1,12 @@
 #include "waterbased.h"
 #include <QtGlobal>
 #include <functional>
-#include <QPainter>
-#include <QPen>
-#include <QBrush>
-#include <QBitmap>
 #include <QObject>
+#include <QtMath>
 #include <QDebug>
 #include <cmath>
 
+#include "dabblitter.h"
 #include "../../misc/shortcutmanager.h"
 #include "../../misc/singleton.h"
 
@@ -28,8 +26,10 @@ WaterBased::WaterBased():
     water_(50),
     extend_(50),
     mixin_(20),
-    color_remain_(255)
+    color_remain_(255),
+    circle_width_(-1)
 {
+    wash_strokes_ = false;
     typedef BrushFeature BF;
     BF::FeatureBits bits;
     bits.set(BF::WIDTH);
@@ -73,143 +73,6 @@ void WaterBased::setMixin(int mixin)
     mixin_ = qBound<int>(BFL::MIXIN_MIN, mixin, BFL::MIXIN_MAX);
 }
 
-// non-reentrant.
-static inline QImage circle_mask(const int width)
-{
-    static QImage mask;
-    if(mask.width() != width || mask.isNull()){
-        mask = QImage(width, width, QImage::Format_ARGB32_Premultiplied);
-        mask.fill(Qt::transparent);
-        QPainter painter;
-        // draw mask
-        painter.begin(&mask);
-        QPen pen(Qt::transparent);
-        painter.setPen(pen);
-        QBrush brush(Qt::black);
-        painter.setBrush(brush);
-        painter.drawEllipse(0, 0, width, width);
-        painter.end();
-    }
-    return mask;
-}
-
-// avg_rgb treats transparent points as white
-static inline QRgb avg_rgb(const QImage& square)
-{
-    QRegion region(0, 0, square.width(), square.height(), QRegion::Ellipse);
-    bool isPremultiplied = square.format() == QImage::Format_ARGB32_Premultiplied;
-    QRgb target = qRgba(255, 255, 255, 0);
-    const QRgb* img_data = (const QRgb*) square.constBits();
-    const size_t img_data_len = square.byteCount() >> (sizeof(QRgb)>>1);
-
-    unsigned int r_sum = 0;
-    unsigned int g_sum = 0;
-    unsigned int b_sum = 0;
-    unsigned int a_sum = 0;
-    unsigned int a_calc_sum = 0;
-
-    unsigned int r = 255;
-    unsigned int g = 255;
-    unsigned int b = 255;
-    unsigned int a = 0;
-    unsigned int a_calc = 0;
-
-    size_t colored = 0;
-    for(size_t i = 0;i<img_data_len;++i){
-        if(!region.contains(QPoint(i/square.width(), i%square.width()))){
-            continue;
-        }
-        QRgb next = *(img_data+i);
-        a_calc = a = qAlpha(next);
-        if(!a){
-            r = 255;
-            g = 255;
-            b = 255;
-            a_calc = 255;
-        }else{
-            if(isPremultiplied){
-                r = qRed(next);
-                g = qGreen(next);
-                b = qBlue(next);
-            }else{
-                r = qRed(next)*a/255;
-                g = qGreen(next)*a/255;
-                b = qBlue(next)*a/255;
-            }
-        }
-
-        ++colored;
-
-        r_sum += r;
-        g_sum += g;
-        b_sum += b;
-        a_sum += a;
-        a_calc_sum += a_calc;
-    }
-    target = qRgba(r_sum *255/a_calc_sum ,
-                   g_sum *255/a_calc_sum,
-                   b_sum *255/a_calc_sum,
-                   a_sum / colored);
-    return target;
-}
-
-// avg_rgb2 does not caculate transparent points
-static inline QRgb avg_rgb2(const QImage& square)
-{
-    QRegion region(0, 0, square.width(), square.height(), QRegion::Ellipse);
-    bool isPremultiplied = square.format() == QImage::Format_ARGB32_Premultiplied;
-    QRgb target = qRgba(0, 0, 0, 0);
-    const QRgb* img_data = (const QRgb*) square.constBits();
-    const size_t img_data_len = square.byteCount() >> (sizeof(QRgb)>>1);
-
-    unsigned int r_sum = 0;
-    unsigned int g_sum = 0;
-    unsigned int b_sum = 0;
-    unsigned int a_sum = 0;
-
-    unsigned int r = 0;
-    unsigned int g = 0;
-    unsigned int b = 0;
-    unsigned int a = 0;
-
-    size_t colored = 0;
-    for(size_t i = 0;i<img_data_len;++i){
-        if(!region.contains(QPoint(i/square.width(), i%square.width()))){
-            continue;
-        }
-        QRgb next = *(img_data+i);
-        a = qAlpha(next);
-        if(!a){
-            continue;
-        }else{
-            if(isPremultiplied){
-                r = qRed(next)*255/a;
-                g = qGreen(next)*255/a;
-                b = qBlue(next)*255/a;
-            }else{
-                r = qRed(next);
-                g = qGreen(next);
-                b = qBlue(next);
-            }
-        }
-
-        ++colored;
-
-        r_sum += r;
-        g_sum += g;
-        b_sum += b;
-        a_sum += a;
-    }
-    if(!colored) {
-        return qRgba(0, 0, 0, 0);
-    }
-    target = qRgba(r_sum / colored ,
-                   g_sum / colored,
-                   b_sum / colored,
-                   a_sum / colored);
-    return target;
-}
-
 static inline QColor watering_color(int water, QColor color)
 {
 //    color.setAlpha((BFL::WATER_MAX - water) * color.alpha() / BFL::WATER_MAX);
@@ -226,23 +89,65 @@ static inline QColor watering_color(int water, QColor color)
     return QColor(r, g, b, color.alpha());
 }
 
+/*!
+    \fn const QVector<int> &WaterBased::circleSpans() const
+
+    Returns the pixels covered by a circle as wide as the brush, as one
+    pair of begin and end columns per row. Rebuilt when the width changes.
+*/
+
+const QVector<int> &WaterBased::circleSpans() const
+{
+    if(circle_width_ != width_){
+        circle_width_ = width_;
+        circle_spans_.resize(width_ * 2);
+        const qreal r = width_ / 2.0;
+        for(int y = 0; y < width_; ++y){
+            // pixels whose center is inside the circle
+            const qreal dy = y + 0.5 - r;
+            const qreal half = std::sqrt(qMax<qreal>(0, r * r - dy * dy));
+            circle_spans_[y * 2] = qCeil(r - half - 0.5);
+            circle_spans_[y * 2 + 1] = qFloor(r + half - 0.5) + 1;
+        }
+    }
+    return circle_spans_;
+}
+
+// averages the colored pixels in a circle around center, read straight
+// from the layer. Colors are weighted by their alpha, so faint pixels
+// count for less than opaque ones.
 QColor WaterBased::fetchColor(const QPoint& center) const
 {
+    const QImage *image = surface_->imageConstPtr();
+    const QVector<int> &spans = circleSpans();
     const int delta_width = width_ >>1;
     const QPoint start_point(center - QPoint(delta_width, delta_width));
 
-    QImage square = surface_->imagePtr()->copy(QRect(start_point, QSize(width_, width_)));
-
-    QImage&& mask = circle_mask(square.width());
-    QPainter painter;
-    // composite
-    painter.begin(&square);
-    painter.setCompositionMode(QPainter::CompositionMode_DestinationIn);
-    painter.drawImage(0, 0, mask);
-    painter.end();
-
-    const QRgb c = avg_rgb2(square);
-    return QColor::fromRgba(c);
+    quint32 sums[4] = {0, 0, 0, 0};
+    int colored = 0;
+    for(int y = 0; y < width_; ++y){
+        const int image_y = start_point.y() + y;
+        if(image_y < 0 || image_y >= image->height()){
+            continue;
+        }
+        const int begin = qMax(start_point.x() + spans[y * 2], 0);
+        const int end = qMin(start_point.x() + spans[y * 2 + 1],
+                             image->width());
+        if(begin >= end){
+            continue;
+        }
+        const quint32 *line = reinterpret_cast<const quint32 *>(
+                    image->constScanLine(image_y));
+        colored += sumPixelRow(line + begin, end - begin, sums);
+    }
+    if(!colored) {
+        return QColor(0, 0, 0, 0);
+    }
+    // the plain mean of the colored pixels, as the brush always mixed
+    return QColor::fromRgba(qRgba(sums[2] / colored,
+                                  sums[1] / colored,
+                                  sums[0] / colored,
+                                  sums[3] / colored));
 }
 
 inline static QColor mingle_color(QColor c1, QColor c2, int percent, int max)
@@ -312,8 +217,7 @@ void WaterBased::drawLineTo(const QPoint &end, qreal presure)
 
     qreal totalDistance = left_ + distance;
 
-    QPainter painter(surface_->imagePtr());
-    painter.setRenderHint(QPainter::Antialiasing);
+    QImage *surface = surface_->imagePtr();
     while ( totalDistance >= spacing ) {
         bool l_f_ = false;
         if ( left_ > 0.0 ) {
@@ -335,7 +239,8 @@ void WaterBased::drawLineTo(const QPoint &end, qreal presure)
         if(l_f_){
             makeStencil(last_color_);
         }else{
-            last_color_ = fetchColor(cur_point);
+            last_color_ = fetchColor(cur_point + QPoint(stencil_.width()>>1,
+                                                        stencil_.height()>>1));
 
             int length = distance;
             color_remain_ -= (length >>1) * (BFL::EXTEND_MAX-extend_)/BFL::EXTEND_MAX;
@@ -347,12 +252,14 @@ void WaterBased::drawLineTo(const QPoint &end, qreal presure)
             makeStencil(mixed_color);
         }
 
-        drawPointInternal(cur_point,
-                          stencil_,
-                          &painter);
+        // the stencil changes every dab, but not how it is drawn
+        BasicBrush::drawPointInternal(cur_point,
+                                      stencil_,
+                                      surface);
 
         totalDistance -= spacing;
     }
+    surface_->markModified();
     left_ = totalDistance;
     last_point_ = end;
 }
@@ -2,6 +2,7 @@
 #define WATERBASED_H
 
 #include <QPoint>
+#include <QVector>
 #include "basicbrush.h"
 
 class WaterBased: public BasicBrush
@@ -29,6 +30,10 @@ protected:
     QColor mingled_color_;
     QColor last_color_;
     int color_remain_;
+    // circle spans for circle_width_, built on first use
+    mutable QVector<int> circle_spans_;
+    mutable int circle_width_;
+    const QVector<int> &circleSpans() const;
     virtual QColor fetchColor(const QPoint& center) const;
 };
 
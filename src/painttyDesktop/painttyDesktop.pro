@@ -90,10 +90,24 @@ SOURCES += main.cpp\
     paintingTools/brush/maskbased.cpp \
     paintingTools/brush/sketchbrush.cpp \
     paintingTools/brush/waterbased.cpp \
+    paintingTools/brush/dabblitter.cpp \
+    paintingTools/brush/capsulerasterizer.cpp \
+    paintingTools/brush/strokewash.cpp \
     widgets/panoramarotator.cpp \
     widgets/networkindicator.cpp \
     widgets/sponsorlabel.cpp \
-    misc/psdexport.cpp
+    misc/psdexport.cpp \
+    misc/tilecompositor.cpp \
+    misc/tilecodec.cpp \
+    misc/strokehistory.cpp \
+    misc/layercompressor.cpp \
+    misc/layerstore.cpp \
+    misc/mippyramid.cpp \
+    misc/framemetrics.cpp \
+    misc/strokebuffer.cpp \
+    misc/strokesimplifier.cpp \
+    misc/brushbenchmark.cpp \
+    widgets/canvasrenderitem.cpp
 
 
 HEADERS  += widgets/mainwindow.h \
@@ -153,10 +167,24 @@ HEADERS  += widgets/mainwindow.h \
     paintingTools/brush/maskbased.h \
     paintingTools/brush/sketchbrush.h \
     paintingTools/brush/waterbased.h \
+    paintingTools/brush/dabblitter.h \
+    paintingTools/brush/capsulerasterizer.h \
+    paintingTools/brush/strokewash.h \
     widgets/panoramarotator.h \
     widgets/networkindicator.h \
     widgets/sponsorlabel.h \
-    misc/psdexport.h
+    misc/psdexport.h \
+    misc/tilecompositor.h \
+    misc/tilecodec.h \
+    misc/strokehistory.h \
+    misc/layercompressor.h \
+    misc/layerstore.h \
+    misc/mippyramid.h \
+    misc/framemetrics.h \
+    misc/strokebuffer.h \
+    misc/strokesimplifier.h \
+    misc/brushbenchmark.h \
+    widgets/canvasrenderitem.h
 
 FORMS    += widgets/mainwindow.ui \
     widgets/roomlistdialog.ui \
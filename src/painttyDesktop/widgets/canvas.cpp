@@ -1,5 +1,6 @@
 #include <QPainter>
 #include <QHash>
+#include <QSet>
 #include <QSharedPointer>
 #include <QJsonDocument>
 #include <QJsonObject>
@@ -9,6 +10,7 @@
 #include <QSettings>
 #include <QApplication>
 #include <QTimer>
+#include <QScreen>
 #include <QDir>
 #include <QStaticText>
 #include <QDateTime>
@@ -18,14 +20,10 @@
 #include "../../common/network/clientsocket.h"
 #include "../paintingTools/brush/brushmanager.h"
 #include "../paintingTools/brush/basicbrush.h"
-#include "../paintingTools/brush/sketchbrush.h"
-#include "../paintingTools/brush/basiceraser.h"
-#include "../paintingTools/brush/binarybrush.h"
-#include "../paintingTools/brush/waterbased.h"
-#include "../paintingTools/brush/maskbased.h"
 #include "../misc/platformextend.h"
 #include "../misc/singleton.h"
 #include "../misc/archivefile.h"
+#include "../misc/brushbenchmark.h"
 
 #include "canvas.h"
 
@@ -65,12 +63,18 @@ Canvas::Canvas(QWidget *parent) :
     canvasSize(Singleton<ClientSocket>::instance().canvasSize()),
     layers(canvasSize),
     image(canvasSize, QImage::Format_ARGB32_Premultiplied),
+    external_render_(false),
+    metrics_("legacy renderer"),
     layerNameCounter(0),
     shareColor_(true),
     jitterCorrection_(true),
     jitterCorrectionLevel_(10),
     backend_(new CanvasBackend(0)),
     worker_(new QThread(this)),
+    compressor_(new LayerCompressor(&layers, this)),
+    store_(new LayerStore(this)),
+    stroke_id_(0),
+    stroke_seq_(0),
     m_tabletEnabled(false)
 
 {
@@ -82,35 +86,57 @@ Canvas::Canvas(QWidget *parent) :
     setFocusPolicy(Qt::WheelFocus); // necessary for IME control
     resize(canvasSize);
 
-    BrushPointer p1(new BasicBrush);
-    p1->setSettings(p1->defaultSettings());
-    BrushPointer p2(new BinaryBrush);
-    p2->setSettings(p1->defaultSettings());
-    BrushPointer p3(new SketchBrush);
-    p3->setSettings(p1->defaultSettings());
-    BrushPointer p4(new BasicEraser);
-    p4->setSettings(p1->defaultSettings());
-    // TODO
-    //    BrushPointer p5(new WaterBased);
-    //    p5->setSettings(p1->defaultSettings());
-    BrushPointer p6(new MaskBased);
-    p6->setSettings(p1->defaultSettings());
-    brush_manager.addBrush(p1);
-    brush_manager.addBrush(p2);
-    brush_manager.addBrush(p3);
-    brush_manager.addBrush(p4);
-    //    brush_manager.addBrush(p5);
-    brush_manager.addBrush(p6);
+    brush_manager.addBuiltinBrushes();
     setJitterCorrectionLevel(5);
+    mip_.reset(canvasSize);
+    dirty_ = QRegion(QRect(QPoint(0, 0), canvasSize));
+
+    QSettings settings(GlobalDef::SETTINGS_NAME,
+                       QSettings::defaultFormat(),
+                       qApp);
+    // budget is in MiB
+    history_.setMemoryBudget(settings.value("canvas/undo_memory_budget", 64)
+                             .toLongLong() * 1024 * 1024);
+    history_.setMaxSteps(settings.value("canvas/undo_steps", 100).toInt());
+    // in-progress strokes are sent every stream_interval ms or
+    // stream_points points, whichever comes first, 0 disables either
+    stream_interval_ = settings.value("canvas/stream_interval", 50).toInt();
+    stream_points_ = settings.value("canvas/stream_points", 64).toInt();
+
+    // one repaint per display refresh at most
+    qreal refresh_rate = 60;
+    if(QGuiApplication::primaryScreen()){
+        refresh_rate = qMax<qreal>(1, QGuiApplication::primaryScreen()->refreshRate());
+    }
+    frame_interval_ = qMax(1, qRound(1000 / refresh_rate));
+    frame_timer_.setSingleShot(true);
+    frame_timer_.setTimerType(Qt::PreciseTimer);
+    connect(&frame_timer_, &QTimer::timeout,
+            this, &Canvas::flushFrame);
+    frame_clock_.start();
+    metrics_.setEnabled(settings.value("canvas/frame_metrics", false).toBool());
+    // idle and hidden layers are packed once resident ones pass the budget
+    compressor_->setMemoryBudget(settings.value("canvas/layer_memory_budget", 512)
+                                 .toLongLong() * 1024 * 1024);
+    compressor_->setIdleTimeout(settings.value("canvas/layer_idle_timeout", 60)
+                                .toInt() * 1000);
 
     worker_->start();
     backend_->moveToThread(worker_);
+    connect(backend_, &CanvasBackend::remoteLayerInterned,
+            this, &Canvas::remoteLayerInterned);
+    connect(backend_, &CanvasBackend::remoteBrushChanged,
+            this, &Canvas::remoteBrushChanged);
     connect(backend_, &CanvasBackend::remoteDrawLine,
             this, &Canvas::remoteDrawLine);
     connect(backend_, &CanvasBackend::remoteDrawPoint,
             this, &Canvas::remoteDrawPoint);
+    connect(backend_, &CanvasBackend::remoteStrokeEnded,
+            this, &Canvas::remoteStrokeEnded);
+    connect(backend_, &CanvasBackend::remoteRestoreTile,
+            this, &Canvas::remoteRestoreTile);
     connect(backend_, &CanvasBackend::repaintHint,
-            this, static_cast<void (Canvas::*)()>(&Canvas::update));
+            this, &Canvas::scheduleFrame);
     //    connect(this, &Canvas::destroyed,
     //            backend_, &CanvasBackend::deleteLater);
     //    connect(this, &Canvas::destroyed,
@@ -119,6 +145,8 @@ Canvas::Canvas(QWidget *parent) :
             backend_, &CanvasBackend::deleteLater);
     connect(this, &Canvas::newPaintAction,
             backend_, &CanvasBackend::onDataBlock);
+    connect(this, &Canvas::newStroke,
+            backend_, &CanvasBackend::onStroke);
     connect(this, &Canvas::parsePaused,
             backend_, &CanvasBackend::pauseParse);
 
@@ -128,6 +156,7 @@ Canvas::Canvas(QWidget *parent) :
 
     qRegisterMetaType<MSI>("CanvasBackend::MemberSectionIndex");
     qRegisterMetaType< QList<MS> >("QList<MemberSection>");
+    qRegisterMetaType<StrokeBuffer>("StrokeBuffer");
 
     connect(backend_, &CanvasBackend::membersSorted,
             this, &Canvas::onMembersSorted);
@@ -169,6 +198,7 @@ Canvas::~Canvas()
 
 QImage Canvas::currentCanvas()
 {
+    flushBrushes();
     QImage pmp = image;
     layers.combineLayers(&pmp);
     return appendAuthorSignature(pmp);
@@ -176,16 +206,10 @@ QImage Canvas::currentCanvas()
 
 QImage Canvas::allCanvas()
 {
+    flushBrushes();
     QImage exp(canvasSize, QImage::Format_ARGB32_Premultiplied);
-    exp.fill(Qt::white);
-    QPainter painter(&exp);
-    int count = layers.count();
-    QImage * im = 0;
-    for(int i=0;i<count;++i){
-        LayerPointer l = layers.layerFrom(i);
-        im = l->imagePtr();
-        painter.drawImage(0, 0, *im);
-    }
+    // hidden layers are exported, too
+    layers.combineLayers(&exp, QRect(), false);
     return appendAuthorSignature(exp);
 }
 
@@ -259,62 +283,9 @@ void Canvas::setJitterCorrectionEnabled(bool correct)
 void Canvas::setJitterCorrectionLevel(int value)
 {
     jitterCorrectionLevel_ = qBound(0, value, 10);
-    jitterCorrectionLevel_internal_ = jitterCorrectionLevel_ * 0.5;
-}
-
-void Canvas::tryJitterCorrection()
-{
-    if(stackPoints.length() < qBound(3, jitterCorrectionLevel_, 10) )
-        return;
-
-    int amount = stackPoints.length();
-    int redudent = amount;
-
-    auto should_correct = [this, &redudent](const QPoint& p1,
-            const QPoint& p2,
-            const QPoint& p3) -> bool
-    {
-        QLine l1(p1, p2);
-        QLine l2(p2, p3);
-        QLine l3(p3, p1);
-
-        qreal A = 1.0;
-        if(l3.dx() != l1.dx()){
-            A = (l1.dy() - l3.dy()) / (l3.dx() - l1.dx());
-        }
-        qreal B = 1.0;
-        qreal C = l1.dx() * (-A) - l1.dy();
-
-        qreal distance_up = A*l2.dx() + B*l2.dy() + C;
-        qreal distance_down = qSqrt(A*A+B*B);
-        if(qFuzzyCompare(distance_down, 0.0)){
-            return false;
-        }
-
-        qreal distance = qAbs(distance_up / distance_down);
-        //        qDebug()<<"distance"<<distance;
-
-        if(distance <= jitterCorrectionLevel_internal_ ){
-            return true;
-        }else{
-            return false;
-        }
-
-    };
-
-    int basePos = 0;
-    while((stackPoints.length() >= 3) && (basePos < stackPoints.length() - 3)){
-        if(should_correct(stackPoints[basePos],
-                          stackPoints[basePos+1],
-                          stackPoints[basePos+2])){
-            stackPoints.removeAt(basePos+1);
-            redudent--;
-        }else{
-            basePos++;
-        }
-    }
-    // you can see the correction rate.
-    //    qDebug()<<"correction rate: "<<qreal(amount-redudent)/amount *100<<"%";
+    // each level allows half a pixel of error
+    simplifier_.setTolerance(jitterCorrectionLevel_ * 0.5);
+    simplifier_.setWindow(qBound(3, jitterCorrectionLevel_, 10));
 }
 
 /*!
@@ -397,6 +368,101 @@ void Canvas::setBrushSettings(const QVariantMap &settings)
     brush_->setSettings(settings);
 }
 
+/*!
+    \fn QString Canvas::benchmarkBrush(int msecs)
+
+    Measures the dabs per second of a copy of the current brush,
+    without and with pressure, spending about \a msecs on each.
+    Meant to be called from the script console.
+*/
+
+QString Canvas::benchmarkBrush(int msecs)
+{
+    QStringList results;
+    for(bool pressure: {false, true}){
+        BrushPointer brush = brush_manager.makeBrush(brush_->name());
+        brush->setSettings(brush_->settings());
+        BrushBenchmark::Result result = BrushBenchmark::run(brush, pressure,
+                                                            msecs, canvasSize);
+        results.append(result.toString());
+    }
+    return results.join("\n");
+}
+
+/*!
+    \fn QString Canvas::benchmarkStrokes(int msecs)
+
+    Measures the segments per second of copies of the current brush at
+    widths from 1 to 100, spending about \a msecs on each. Brushes that
+    can sweep segments as capsules are measured both ways.
+    Meant to be called from the script console.
+*/
+
+QString Canvas::benchmarkStrokes(int msecs)
+{
+    QStringList results;
+    for(int width: {1, 2, 5, 10, 20, 50, 100}){
+        for(bool capsules: {true, false}){
+            BrushPointer brush = brush_manager.makeBrush(brush_->name());
+            brush->setSettings(brush_->settings());
+            brush->setWidth(width);
+            BasicBrush *basic = dynamic_cast<BasicBrush *>(brush.data());
+            if(basic){
+                basic->setCapsuleStrokes(capsules);
+            }else if(!capsules){
+                break;
+            }
+            BrushBenchmark::Result result
+                    = BrushBenchmark::runStrokes(brush, false,
+                                                 msecs, canvasSize);
+            const QString line = QString("width %1, capsules %2: %3")
+                    .arg(width)
+                    .arg(basic ? (capsules ? "on" : "off") : "n/a")
+                    .arg(result.toString());
+            results.append(line);
+        }
+    }
+    return results.join("\n");
+}
+
+/*!
+    \fn QString Canvas::layerStorageStats() const
+
+    Describes how often layers were found resident or had to be
+    unpacked, and how long that took, and how long packed layers took
+    to paint. Meant to be called from the script console.
+*/
+
+QString Canvas::layerStorageStats() const
+{
+    const Layer::Stats s = Layer::stats();
+    return QString("layer storage hits: %1, avg %2 ns; "
+                   "misses: %3, avg %4 ns, max %5 ns; "
+                   "packed paints: %6, avg %7 ns")
+            .arg(s.hits)
+            .arg(s.hits ? s.hitNsecs / s.hits : 0)
+            .arg(s.misses)
+            .arg(s.misses ? s.missNsecs / s.misses : 0)
+            .arg(s.maxMissNsecs)
+            .arg(s.paintDecodes)
+            .arg(s.paintDecodes ? s.paintDecodeNsecs / s.paintDecodes : 0);
+}
+
+/*!
+    \fn QString Canvas::simplifierStats() const
+
+    Describes how many stroke points the simplifier kept of those it
+    was given. Meant to be called from the script console.
+*/
+
+QString Canvas::simplifierStats() const
+{
+    return QString("stroke simplifier kept %1 of %2 points, %3% dropped")
+            .arg(simplifier_.keptCount())
+            .arg(simplifier_.pushedCount())
+            .arg(qRound(simplifier_.reduction() * 100));
+}
+
 BrushPointer Canvas::brushFactory(const QString &name)
 {
     return Singleton<BrushManager>::instance().makeBrush(name);
@@ -413,15 +479,12 @@ void Canvas::loadLayers()
 {
     // TODO: merge this feature into ArchiveFile, maybe?
     QString dir_name = Singleton<ArchiveFile>::instance().dirName();
-    for(int i=layers.count()-1;i>=0;--i){
-        QString img_name = QString("%1/%2.png").arg(dir_name).arg(i);
-        QImage img(img_name);
-        if(img.isNull()){
-            continue;
-        }
-        QPainter painter(layers.layerFrom(i)->imagePtr());
-        painter.drawImage(0, 0, img);
-    }
+    connect(store_, &LayerStore::layerLoaded,
+            [this](){
+        markAllDirty();
+    });
+    // returns once the selected layer is in, the rest follow
+    store_->load(layers, dir_name, layers.selectedLayer());
     //    connect(&Singleton<ArchiveFile>::instance(), &ArchiveFile::newSignature,
     //            [this](){
     //        this->clearAllLayer();
@@ -430,22 +493,25 @@ void Canvas::loadLayers()
             this, &Canvas::clearAllLayer);
 }
 
+/*!
+    \fn void Canvas::saveLayers()
+
+    Starts writing the layers changed since the last save to the room
+    cache, and returns at once. Writing goes on in the background.
+    \sa LayerStore
+*/
+
 void Canvas::saveLayers()
 {
+    flushBrushes();
     // TODO: merge this feature into ArchiveFile, maybe?
     QString dir_name = Singleton<ArchiveFile>::instance().dirName();
-    QDir::current().mkpath(dir_name);
-    for(int i=layers.count()-1;i>=0;--i){
-        if(!layers.layerFrom(i)->isTouched()){
-            continue;
-        }
-        QString img_name = QString("%1/%2.png").arg(dir_name).arg(i);
-        layers.layerFrom(i)->imageConstPtr()->save(img_name);
-    }
+    store_->save(layers, dir_name);
 }
 
 QList<QImage> Canvas::layerImages() const
 {
+    flushBrushes();
     QList<QImage> lists;
     for(int i=0;i<layers.count();++i){
         if(!layers.layerFrom(i)->isTouched()){
@@ -471,6 +537,7 @@ void Canvas::pause()
 
 void Canvas::changeBrush(const QString &name)
 {
+    brush_->endStroke();
     QVariantMap currentSettings;
     LayerPointer sur = brush_->surface();
     QVariantMap colorMap = brush_->settings()
@@ -542,17 +609,22 @@ void Canvas::drawLineTo(const QPoint &endPoint, qreal pressure)
     }
     updateCursor();
     brush_->setSurface(l);
+    flushOtherBrushes(brush_.data(), l);
+    QRect rect = brush_->affectedRect(endPoint);
+    history_.capture(rect);
     brush_->drawLineTo(endPoint, pressure);
 
-    update();
+    markDirty(brush_->takeDirtyRect());
 
-    QVariantMap point;
-    point.insert("x", endPoint.x());
-    point.insert("y", endPoint.y());
-    // guarantee that pressure is double
-    point.insert("pressure", double(pressure));
+    stroke_.append(endPoint, pressure);
 
-    storeAction(point);
+    // stream long strokes in chunks, so others see them while drawn
+    const int n = stroke_.count();
+    if((stream_points_ > 0 && n >= stream_points_)
+            || (stream_interval_ > 0
+                && stroke_.timestamp(n - 1) >= quint32(stream_interval_))){
+        sendAction(false);
+    }
 }
 
 /*!
@@ -572,28 +644,35 @@ void Canvas::drawPoint(const QPoint &point, qreal pressure)
     }
     updateCursor();
     brush_->setSurface(l);
-    brush_->drawPoint(point, pressure);
-
+    flushOtherBrushes(brush_.data(), l);
     int rad = (brush_->width() / 2) + 2;
-    update(QRect(lastPoint, point).normalized()
-           .adjusted(-rad, -rad, +rad, +rad));
+    // a point always starts a new stroke
+    history_.begin(l);
+    ++stroke_id_;
+    stroke_seq_ = 0;
+    history_.capture(QRect(point, point).adjusted(-rad, -rad, +rad, +rad));
+    brush_->drawPoint(point, pressure);
 
-    QVariantMap point_j;
-    point_j.insert("x", point.x());
-    point_j.insert("y", point.y());
-    // guarantee that pressure is double
-    point_j.insert("pressure", double(pressure));
+    markDirty(brush_->takeDirtyRect());
 
-    storeAction(point_j);
+    stroke_.append(point, pressure);
 }
 
-void Canvas::storeAction(const QVariantMap &map)
-{
-    action_buffer_.push_back(map);
-}
+/*!
+    \fn void Canvas::sendAction(bool finished)
+
+    Sends the points recorded since the last call as one chunk of the
+    current stroke. Chunks carry the stroke id and a sequence number,
+    and every chunk after the first begins with the point the previous
+    one ended at, so receivers can resume the stroke from there.
+    The last chunk is sent with \a finished set.
+*/
 
-void Canvas::sendAction()
+void Canvas::sendAction(bool finished)
 {
+    if(stroke_.isEmpty()){
+        return;
+    }
     QVariantMap store;
     store.insert("layer", currentLayer());
     store.insert("clientid",
@@ -603,10 +682,103 @@ void Canvas::sendAction()
     store.insert("type", "data");
     store.insert("brush", brushSettings());
     store.insert("action", "block");
-    store.insert("block", action_buffer_);
+    store.insert("stroke", stroke_id_);
+    store.insert("seq", stroke_seq_);
+    if(finished){
+        store.insert("final", true);
+    }
+
+    const int last = stroke_.count() - 1;
+    const QPoint joint = stroke_.point(last);
+    const qreal pressure = stroke_.pressure(last);
+    if(finished && stroke_seq_ > 0 && last == 0){
+        // nothing but the joint, the chunk only closes the stroke
+        stroke_.clear();
+    }
+
+    // the backend serializes the points straight from the buffer.
+    // Buffers are swapped so the next chunk is written into the one
+    // the backend has most likely dropped already.
+    emit newStroke(stroke_, store);
+    std::swap(stroke_, spare_stroke_);
+    stroke_.clear();
+    ++stroke_seq_;
+    if(!finished){
+        stroke_.append(joint, pressure);
+    }
+}
+
+void Canvas::sendRestore(const StrokeHistory::Step &step)
+{
+    QVariantList tiles;
+    for(int i=0;i<step.tiles.count();++i){
+        QVariantMap tile;
+        tile.insert("x", step.positions[i].x());
+        tile.insert("y", step.positions[i].y());
+        tile.insert("data", QString::fromLatin1(step.tiles[i].toBase64()));
+        tile.insert("expected",
+                    QString::fromLatin1(step.expected[i].toBase64()));
+        tiles.append(tile);
+    }
+
+    QVariantMap store;
+    store.insert("layer", step.layer);
+    store.insert("clientid",
+                 Singleton<ClientSocket>::instance().clientId());
+    store.insert("name",
+                 Singleton<ClientSocket>::instance().userName());
+    store.insert("type", "data");
+    store.insert("action", "restore");
+    store.insert("tiles", tiles);
 
     emit newPaintAction(store);
-    action_buffer_.clear();
+}
+
+/*!
+    \fn void Canvas::undo()
+
+    Reverts the last local stroke, and tells others to restore
+    the same region. Remote painters never replay the stroke.
+
+    Only pixels that still look as the stroke left them are reverted,
+    here and on every peer. Where someone painted over the stroke since,
+    their painting is kept, and so is the stroke under it.
+    \sa redo()
+*/
+
+void Canvas::undo()
+{
+    if(control_mode_ == DRAWING){
+        return;
+    }
+    flushBrushes();
+    StrokeHistory::Step step = history_.undo(layers);
+    if(step.tiles.isEmpty()){
+        return;
+    }
+    markDirty(step.boundingRect());
+    sendRestore(step);
+}
+
+/*!
+    \fn void Canvas::redo()
+
+    Re-applies the last stroke reverted by undo().
+    \sa undo()
+*/
+
+void Canvas::redo()
+{
+    if(control_mode_ == DRAWING){
+        return;
+    }
+    flushBrushes();
+    StrokeHistory::Step step = history_.redo(layers);
+    if(step.tiles.isEmpty()){
+        return;
+    }
+    markDirty(step.boundingRect());
+    sendRestore(step);
 }
 
 void Canvas::pickColor(const QPoint &point)
@@ -621,110 +793,251 @@ void Canvas::updateCursor()
 }
 
 /*!
-    \fn void Canvas::remoteDrawPoint(const QPoint &point, const QVariantMap &brushInfo,
-                             const QString &layer,
-                             const quint64 userid)
+    \fn void Canvas::remoteLayerInterned(int layer, const QString &name)
 
-    Draws a remote point at \a point at \a layer with \a brushInfo.
-    To identical user, \a userid must provided.
-    \sa Canvas::remoteDrawLine()
+    Records that remote drawing refers to layer \a name by id \a layer.
 */
 
-void Canvas::remoteDrawPoint(const QPoint &point,
-                             const QVariantMap &brushInfo,
-                             const QString &layer,
-                             const QString clientid,
-                             const qreal pressure)
+void Canvas::remoteLayerInterned(int layer, const QString &name)
 {
-    if(!layers.exists(layer)) return;
-    LayerPointer l = layers.layerFrom(layer);
+    if(layer >= remote_layers_.count()){
+        remote_layers_.resize(layer + 1);
+    }
+    remote_layers_[layer].name = name;
+    remote_layers_[layer].revision = -1;
+}
+
+/*!
+    \fn const LayerPointer &Canvas::remoteLayer(int id)
 
+    Returns the layer remote drawing calls \a id, which is null if it
+    does not exist. The lookup by name only happens again after layers
+    are added, removed or renamed.
+*/
+
+const LayerPointer &Canvas::remoteLayer(int id)
+{
+    static const LayerPointer none;
+    if(id < 0 || id >= remote_layers_.count()){
+        return none;
+    }
+    RemoteLayer &remote = remote_layers_[id];
+    if(remote.revision != layers.revision()){
+        remote.layer = layers.exists(remote.name) ? layers.layerFrom(remote.name)
+                                                  : LayerPointer();
+        remote.revision = layers.revision();
+    }
+    return remote.layer;
+}
+
+/*!
+    \fn void Canvas::remoteBrushChanged(const QVariantMap &brushInfo,
+                                       int client)
+
+    Configures the brush that draws for \a client with \a brushInfo.
+    CanvasBackend only calls this when the settings change, so remote
+    strokes drawn with the same brush skip reconfiguration.
+    \sa Canvas::remoteDrawPoint(), Canvas::remoteDrawLine()
+*/
+
+void Canvas::remoteBrushChanged(const QVariantMap &brushInfo,
+                                int client)
+{
     QVariantMap cpd_brushInfo = brushInfo;
-    QString brushName = cpd_brushInfo["name"].toString().toLower();
+    QString brushName = cpd_brushInfo["name"].toString();
 
     cpd_brushInfo.remove("name"); // remove useless info
 
-    if(remoteBrush.contains(clientid)){
-        BrushPointer t = remoteBrush[clientid];
-        if(brushName != t->name().toLower()){
-            BrushPointer newOne = brushFactory(brushName);
-            newOne->setSurface(l);
-            newOne->setSettings(cpd_brushInfo);
-            newOne->drawPoint(point, pressure);
-            remoteBrush[clientid] = newOne;
-            //            t.clear();
-        }else{
-            BrushPointer original = remoteBrush[clientid];
-            original->setSurface(l);
-            original->setSettings(cpd_brushInfo);
-            original->drawPoint(point, pressure);
+    if(client >= remote_brushes_.count()){
+        remote_brushes_.resize(client + 1);
+    }
+    RemoteBrush &remote = remote_brushes_[client];
+    const int type = brush_manager.typeOf(brushName);
+    if(!remote.brush || type != remote.type){
+        if(type < 0){
+            qWarning()<<"Brush"<<brushName<<" cannot identify";
         }
-    }else{
-        BrushPointer newOne = brushFactory(brushName);
-        newOne->setSurface(l);
-        newOne->setSettings(cpd_brushInfo);
-        newOne->drawPoint(point, pressure);
-        remoteBrush[clientid] = newOne;
+        if(remote.brush){
+            remote.brush->endStroke();
+        }
+        remote.brush = brush_manager.makeBrush(type);
+        remote.type = type;
     }
+    remote.brush->setSettings(cpd_brushInfo);
+}
+
+/*!
+    \fn void Canvas::remoteDrawPoint(const QPoint &point,
+                             int layer,
+                             int client,
+                             const qreal pressure)
+
+    Draws a remote point at \a point at \a layer with the brush
+    of \a client.
+    \sa Canvas::remoteDrawLine(), Canvas::remoteBrushChanged()
+*/
+
+void Canvas::remoteDrawPoint(const QPoint &point,
+                             int layer,
+                             int client,
+                             const qreal pressure)
+{
+    const LayerPointer &l = remoteLayer(layer);
+    if(!l) return;
 
-    //    update();
+    if(client >= remote_brushes_.count() || !remote_brushes_[client].brush){
+        qDebug()<<"warning, remote drawing without brush settings";
+        return;
+    }
+    AbstractBrush *brush = remote_brushes_[client].brush.data();
+    brush->setSurface(l);
+    flushOtherBrushes(brush, l);
+    brush->drawPoint(point, pressure);
+
+    // repaint is left to CanvasBackend::repaintHint
+    QRect rect = brush->takeDirtyRect();
+    dirty_ |= rect;
+    repaint_ |= rect;
 }
 
 /*!
     \fn void Canvas::remoteDrawLine(const QPoint &start, const QPoint &end,
-                            const QVariantMap &brushInfo,
-                            const QString &layer,
-                            const quint64 userid)
+                            int layer,
+                            int client,
+                            const qreal pressure)
 
-    Draws a remote line from \a start to \a end at \a layer with \a brushInfo .
-    To identical user, \a userid must provided.
-    \sa Canvas::remoteDrawLine()
+    Draws a remote line from \a start to \a end at \a layer with the
+    brush of \a client.
+    \sa Canvas::remoteDrawPoint(), Canvas::remoteBrushChanged()
 */
 
 void Canvas::remoteDrawLine(const QPoint &, const QPoint &end,
-                            const QVariantMap &brushInfo,
-                            const QString &layer,
-                            const QString clientid,
+                            int layer,
+                            int client,
                             const qreal pressure)
+{
+    const LayerPointer &l = remoteLayer(layer);
+    if(!l){
+        return;
+    }
+
+    if(client >= remote_brushes_.count() || !remote_brushes_[client].brush){
+        qDebug()<<"warning, remote drawing without brush settings";
+        return;
+    }
+    AbstractBrush *brush = remote_brushes_[client].brush.data();
+    brush->setSurface(l);
+    flushOtherBrushes(brush, l);
+    brush->drawLineTo(end, pressure);
+
+    // repaint is left to CanvasBackend::repaintHint
+    QRect rect = brush->takeDirtyRect();
+    dirty_ |= rect;
+    repaint_ |= rect;
+}
+
+/*!
+    \fn void Canvas::remoteStrokeEnded(int client)
+
+    Ends the stroke \a client is drawing, so its brush writes what it
+    held back and lets go of it.
+*/
+
+void Canvas::remoteStrokeEnded(int client)
+{
+    if(client >= remote_brushes_.count() || !remote_brushes_[client].brush){
+        return;
+    }
+    remote_brushes_[client].brush->endStroke();
+}
+
+void Canvas::remoteRestoreTile(const QPoint &pos,
+                               const QImage &tile,
+                               const QImage &expected,
+                               const QString &layer,
+                               const QString)
 {
     if(!layers.exists(layer)){
         return;
     }
+    // the tile is only restored where it still holds what the stroke
+    // left, so what brushes held back of it must be there first
+    flushBrushes();
     LayerPointer l = layers.layerFrom(layer);
+    StrokeHistory::restoreTile(l->imagePtr(), pos, tile, expected);
+    l->markModified();
+    markDirty(QRect(pos, tile.size()));
+}
 
-    QVariantMap cpd_brushInfo = brushInfo;
-    QString brushName = cpd_brushInfo["name"].toString().toLower();
-
-    if(remoteBrush.contains(clientid)){
-        BrushPointer t = remoteBrush[clientid];
-        if(brushName != t->name().toLower()){
-            BrushPointer newOne = brushFactory(brushName);
-            newOne->setSurface(l);
-            newOne->setSettings(cpd_brushInfo);
-            newOne->drawLineTo(end, pressure);
-            remoteBrush[clientid] = newOne;
-            //            t.clear();
-        }else{
-            BrushPointer original = remoteBrush[clientid];
-            original->setSurface(l);
-            original->setSettings(cpd_brushInfo);
-            original->drawLineTo(end, pressure);
+static inline qint64 find_newest_active(const QList<CanvasBackend::MemberSection>& al)
+{
+    qint64 longest = 0;
+    for(auto &item: al) {
+        qint64 stamp = std::get<MSI::LastActiveStamp>(item);
+        if(stamp > longest){
+            longest = stamp;
         }
-    }else{
-        BrushPointer newOne = brushFactory(brushName);
-        newOne->setSurface(l);
-        newOne->setSettings(cpd_brushInfo);
-        qDebug()<<"warning, remote drawing starts with line drawing";
-        newOne->drawLineTo(end, pressure);
-        remoteBrush[clientid] = newOne;
     }
-    //    update();
+    if(!longest){
+        longest = QDateTime::currentMSecsSinceEpoch();
+    }
+    return longest;
 }
 
 void Canvas::onMembersSorted(const QList<MS>& list)
 {
     author_list_ = list;
-    update();
+
+    // find tips to show, and repaint only where they appear,
+    // move or vanish
+    QHash<QString, AuthorTip> tips;
+    qint64 longest = find_newest_active(author_list_);
+    for(auto& item: author_list_){
+        QPoint point = std::get<MSI::Footprint>(item);
+        QString name = std::get<MSI::Name>(item);
+        qint64 stamp = std::get<MSI::LastActiveStamp>(item);
+        if(name.isEmpty()){
+            name = std::get<MSI::Id>(item);
+        }
+        if(longest - stamp > 1000*30){
+            continue;
+        }
+        if(point.isNull()){
+            break;
+        }
+
+        AuthorTip tip;
+        tip.pixmap = authorTip(name);
+        tip.rect = QRect(point, tip.pixmap.size());
+        tips.insert(std::get<MSI::Id>(item), tip);
+    }
+
+    for(auto it = author_tips_.constBegin(); it != author_tips_.constEnd(); ++it){
+        if(tips.value(it.key()).rect != it.value().rect){
+            repaint_ |= it.value().rect;
+        }
+    }
+    for(auto it = tips.constBegin(); it != tips.constEnd(); ++it){
+        if(author_tips_.value(it.key()).rect != it.value().rect){
+            repaint_ |= it.value().rect;
+        }
+    }
+    author_tips_ = tips;
+    scheduleFrame();
+
+    // forget the tips of those who left
+    QSet<QString> names;
+    for(auto& item: author_list_){
+        const QString &name = std::get<MSI::Name>(item);
+        names.insert(name.isEmpty() ? std::get<MSI::Id>(item) : name);
+    }
+    for(auto it = tip_cache_.begin(); it != tip_cache_.end(); ){
+        if(names.contains(it.key())){
+            ++it;
+        }else{
+            it = tip_cache_.erase(it);
+        }
+    }
 }
 
 /* Layer */
@@ -768,21 +1081,25 @@ bool Canvas::deleteLayer(const QString &name)
         return false;
 
     layers.removeLayer(name);
-    update();
+    history_.clear();
+    markAllDirty();
     return true;
 }
 
 void Canvas::clearLayer(const QString &name)
 {
     layers.clearLayer(name);
-    update();
+    history_.clear();
+    markAllDirty();
 }
 
 void Canvas::clearAllLayer()
 {
     emit requestClearMembers();
     layers.clearAllLayer();
-    update();
+    history_.clear();
+    store_->cancelLoading();
+    markAllDirty();
 }
 
 /*!
@@ -819,7 +1136,7 @@ void Canvas::unlockLayer(const QString &name)
 void Canvas::hideLayer(const QString &name)
 {
     layers.layerFrom(name)->hide();
-    update();
+    markAllDirty();
 }
 
 /*!
@@ -832,19 +1149,19 @@ void Canvas::hideLayer(const QString &name)
 void Canvas::showLayer(const QString &name)
 {
     layers.layerFrom(name)->show();
-    update();
+    markAllDirty();
 }
 
 void Canvas::moveLayerUp(const QString &name)
 {
     layers.moveUp(name);
-    update();
+    markAllDirty();
 }
 
 void Canvas::moveLayerDown(const QString &name)
 {
     layers.moveDown(name);
-    update();
+    markAllDirty();
 }
 
 /*!
@@ -884,7 +1201,7 @@ void Canvas::tabletEvent(QTabletEvent *event)
         case NONE:
             control_mode_ = DRAWING;
         case DRAWING:
-            stackPoints.push_back(lastPoint);
+            simplifier_.begin(lastPoint, event->pressure());
             drawPoint(lastPoint, event->pressure());
         }
         break;
@@ -906,15 +1223,10 @@ void Canvas::tabletEvent(QTabletEvent *event)
             break;
         case DRAWING:
             if(jitterCorrection_){
-                if(stackPoints.length() < qBound(3, jitterCorrectionLevel_, 10)){
-                    stackPoints.push_back(event->pos());
-                }else{
-                    tryJitterCorrection();
-                    for(auto &p: stackPoints){
-                        drawLineTo(p, event->pressure());
-                        lastPoint = p;
-                    }
-                    stackPoints.clear();
+                StrokeSimplifier::Point p;
+                if(simplifier_.push(event->pos(), event->pressure(), &p)){
+                    drawLineTo(p.pos, p.pressure);
+                    lastPoint = p.pos;
                 }
             }else{
                 drawLineTo(event->pos(), event->pressure());
@@ -934,8 +1246,15 @@ void Canvas::tabletEvent(QTabletEvent *event)
         default:
             // fall-through
         case DRAWING:
-            stackPoints.clear();
+            if(jitterCorrection_){
+                StrokeSimplifier::Point p;
+                if(simplifier_.flush(&p)){
+                    drawLineTo(p.pos, p.pressure);
+                }
+            }
             updateCursor();
+            brush_->endStroke();
+            history_.commit();
             sendAction();
             control_mode_ = NONE;
         }
@@ -983,7 +1302,7 @@ void Canvas::mousePressEvent(QMouseEvent *event)
         case NONE:
             control_mode_ = DRAWING;
         case DRAWING:
-            stackPoints.push_back(lastPoint);
+            simplifier_.begin(lastPoint, 1.0);
             drawPoint(lastPoint);
         }
     }
@@ -1007,15 +1326,10 @@ void Canvas::mouseMoveEvent(QMouseEvent *event)
             break;
         case DRAWING:
             if(jitterCorrection_){
-                if(stackPoints.length() < qBound(3, jitterCorrectionLevel_, 10)){
-                    stackPoints.push_back(event->pos());
-                }else{
-                    tryJitterCorrection();
-                    for(auto &p: stackPoints){
-                        drawLineTo(p);
-                        lastPoint = p;
-                    }
-                    stackPoints.clear();
+                StrokeSimplifier::Point p;
+                if(simplifier_.push(event->pos(), 1.0, &p)){
+                    drawLineTo(p.pos, p.pressure);
+                    lastPoint = p.pos;
                 }
             }else{
                 drawLineTo(event->pos());
@@ -1039,41 +1353,45 @@ void Canvas::mouseReleaseEvent(QMouseEvent *event)
         default:
             // fall-through
         case DRAWING:
-            stackPoints.clear();
+            if(jitterCorrection_){
+                StrokeSimplifier::Point p;
+                if(simplifier_.flush(&p)){
+                    drawLineTo(p.pos, p.pressure);
+                }
+            }
             updateCursor();
+            brush_->endStroke();
+            history_.commit();
             sendAction();
             control_mode_ = NONE;
         }
     }
 }
 
-static inline qint64 find_newest_active(const QList<CanvasBackend::MemberSection>& al)
+/*!
+    \fn const QPixmap &Canvas::authorTip(const QString &name)
+
+    Returns the tip showing \a name, rendered once and then cached.
+*/
+
+const QPixmap &Canvas::authorTip(const QString &name)
 {
-    qint64 longest = 0;
-    for(auto &item: al) {
-        qint64 stamp = std::get<MSI::LastActiveStamp>(item);
-        if(stamp > longest){
-            longest = stamp;
-        }
-    }
-    if(!longest){
-        longest = QDateTime::currentMSecsSinceEpoch();
+    auto it = tip_cache_.constFind(name);
+    if(it != tip_cache_.constEnd()){
+        return it.value();
     }
-    return longest;
-}
 
-void Canvas::drawAuthorTips(QPainter& painter,
-                            const QPoint& pos,
-                            const QString& name)
-{
     QFontMetrics fm(this->font());
     int t_width = fm.width(name)+15;
     int t_height = fm.height()+15;
-    QRect box_rect(pos.x(), pos.y(), t_width, t_height);
+    QRect box_rect(0, 0, t_width, t_height);
 
-    painter.save();
+    QPixmap tip(box_rect.size());
+    tip.fill(Qt::transparent);
+    QPainter painter(&tip);
     QPen pen(Qt::transparent);
     QBrush brush(Qt::black);
+    painter.setFont(this->font());
     painter.setRenderHints(QPainter::Antialiasing|QPainter::TextAntialiasing, true);
     painter.setOpacity(0.6);
     painter.setPen(pen);
@@ -1083,7 +1401,162 @@ void Canvas::drawAuthorTips(QPainter& painter,
     pen.setColor(Qt::white);
     painter.setPen(pen);
     painter.drawText(box_rect, Qt::AlignCenter, name);
-    painter.restore();
+    painter.end();
+
+    return tip_cache_.insert(name, tip).value();
+}
+
+/*!
+    \fn void Canvas::markDirty(const QRect &rect)
+
+    Marks \a rect of the layers as changed, and schedules a repaint of
+    it with the next frame.
+    \sa markAllDirty(), compositeDirty(), scheduleFrame()
+*/
+
+void Canvas::markDirty(const QRect &rect)
+{
+    if(rect.isEmpty()){
+        return;
+    }
+    dirty_ |= rect;
+    repaint_ |= rect;
+    scheduleFrame();
+}
+
+void Canvas::markAllDirty()
+{
+    markDirty(QRect(QPoint(0, 0), canvasSize));
+}
+
+/*!
+    \fn void Canvas::scheduleFrame()
+
+    Repaints the areas collected since the last frame, at most once per
+    display refresh. Input at a higher rate than the display, and bursts
+    of remote strokes, are folded into a single repaint this way.
+*/
+
+void Canvas::scheduleFrame()
+{
+    if(repaint_.isEmpty() || frame_timer_.isActive()){
+        return;
+    }
+    const qint64 wait = frame_interval_ - frame_clock_.elapsed();
+    frame_timer_.start(qMax<qint64>(0, wait));
+}
+
+void Canvas::flushFrame()
+{
+    frame_clock_.restart();
+    QRegion region = repaint_;
+    repaint_ = QRegion();
+    update(region);
+}
+
+/*!
+    \fn void Canvas::compositeDirty()
+
+    Composites the changed areas into the canvas image, and passes
+    them on to the mip pyramid. Areas that only need repainting,
+    for example while panning, are not composited again.
+*/
+
+void Canvas::compositeDirty()
+{
+    flushBrushes();
+    if(dirty_.isEmpty()){
+        return;
+    }
+    QRect bounds(QPoint(0, 0), canvasSize);
+    QVector<QRect> rects = dirty_.rects();
+    dirty_ = QRegion();
+    for(const QRect &rect: rects){
+        QRect r = rect.intersected(bounds);
+        layers.combineLayers(&image, r);
+        mip_.invalidate(r);
+        emit contentUpdated(r);
+    }
+}
+
+/*!
+    \fn void Canvas::flushBrushes() const
+
+    Lets the local and all remote brushes write what they have drawn
+    so far into their layers. Brushes may hold back a stroke until then,
+    and the areas were marked dirty already.
+*/
+
+void Canvas::flushBrushes() const
+{
+    brush_->flush();
+    for(const RemoteBrush &remote: remote_brushes_){
+        if(remote.brush){
+            remote.brush->flush();
+        }
+    }
+}
+
+/*!
+    \fn void Canvas::flushOtherBrushes(const AbstractBrush *brush,
+                                       const LayerPointer &layer) const
+
+    Lets every brush but \a brush write what it holds back for \a layer,
+    before \a brush draws into it. Where strokes overlap, they land in
+    the layer in the order they were drawn or received.
+*/
+
+void Canvas::flushOtherBrushes(const AbstractBrush *brush,
+                               const LayerPointer &layer) const
+{
+    if(brush_.data() != brush && brush_->surface() == layer){
+        brush_->flush();
+    }
+    for(const RemoteBrush &remote: remote_brushes_){
+        if(remote.brush && remote.brush.data() != brush
+                && remote.brush->surface() == layer){
+            remote.brush->flush();
+        }
+    }
+}
+
+const QImage &Canvas::compositeImage() const
+{
+    return image;
+}
+
+/*!
+    \fn const QImage &Canvas::mipLevel(int level)
+
+    Returns \a level of the composite, downsampled by 2 to the power
+    of \a level. Call compositeDirty() first for an up to date result.
+*/
+
+const QImage &Canvas::mipLevel(int level)
+{
+    if(level <= 0){
+        return image;
+    }
+    return mip_.level(qMin(level, mip_.levelCount() - 1), image);
+}
+
+/*!
+    \fn void Canvas::setRenderedExternally(bool external)
+
+    When \a external is true, paintEvent() only paints overlays such as
+    author tips, and leaves the canvas itself to a renderer such as
+    CanvasRenderItem, which composites through compositeDirty().
+*/
+
+void Canvas::setRenderedExternally(bool external)
+{
+    external_render_ = external;
+    setAttribute(Qt::WA_NoSystemBackground, external);
+    QPalette pal = palette();
+    pal.setColor(QPalette::Window, external ? QColor(Qt::transparent)
+                                            : QApplication::palette().color(QPalette::Window));
+    setPalette(pal);
+    update();
 }
 
 void Canvas::paintEvent(QPaintEvent *event)
@@ -1092,28 +1565,31 @@ void Canvas::paintEvent(QPaintEvent *event)
     QPainter painter(this);
     QRect dirtyRect = event->rect();
     if(dirtyRect.isEmpty())return;
-    layers.combineLayers(&image, dirtyRect);
 
-    painter.drawImage(dirtyRect, image, dirtyRect);
-
-    // filter outdated names.
-    // Considering using another QImage instead of direct draw
-    qint64 longest = find_newest_active(author_list_);
-    for(auto& item: author_list_){
-        QPoint point = std::get<MSI::Footprint>(item);
-        QString name = std::get<MSI::Name>(item);
-        qint64 stamp = std::get<MSI::LastActiveStamp>(item);
-        if(name.isEmpty()){
-            name = std::get<MSI::Id>(item);
-        }
-        if(longest - stamp > 1000*30){
-            continue;
-        }
-        if(point.isNull()){
-            break;
+    if(!external_render_){
+        metrics_.begin();
+        compositeDirty();
+
+        // when zoomed out, draw from the closest mip level
+        const QTransform &transform = painter.deviceTransform();
+        int level = MipPyramid::levelFor(qSqrt(qAbs(transform.determinant())));
+        if(level > 0){
+            const qreal f = 1 << level;
+            painter.drawImage(QRectF(dirtyRect), mip_.level(level, image),
+                              QRectF(dirtyRect.x() / f, dirtyRect.y() / f,
+                                     dirtyRect.width() / f,
+                                     dirtyRect.height() / f));
+        }else{
+            painter.drawImage(dirtyRect, image, dirtyRect);
         }
+        metrics_.end();
+    }
 
-        drawAuthorTips(painter, point, name);
+    // tips are filtered and rendered in onMembersSorted()
+    for(const AuthorTip &tip: author_tips_){
+        if(tip.rect.intersects(dirtyRect)){
+            painter.drawPixmap(tip.rect.topLeft(), tip.pixmap);
+        }
     }
 
     if(!isEnabled()){
@@ -1146,8 +1622,9 @@ void Canvas::resizeEvent(QResizeEvent *event)
     QPainter painter(&newImage);
     painter.drawImage(QPoint(0, 0), image);
     image = newImage;
+    mip_.reset(newSize);
 
-    update();
+    markAllDirty();
     QWidget::resizeEvent(event);
 }
 
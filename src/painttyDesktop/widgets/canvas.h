@@ -2,8 +2,17 @@
 #define CANVAS_H
 
 #include <QWidget>
+#include <QTimer>
+#include <QElapsedTimer>
 #include "../paintingTools/brush/abstractbrush.h"
 #include "../misc/layermanager.h"
+#include "../misc/strokehistory.h"
+#include "../misc/strokebuffer.h"
+#include "../misc/strokesimplifier.h"
+#include "../misc/layercompressor.h"
+#include "../misc/layerstore.h"
+#include "../misc/mippyramid.h"
+#include "../misc/framemetrics.h"
 #include "canvasbackend.h"
 
 typedef QSharedPointer<AbstractBrush> BrushPointer;
@@ -24,6 +33,10 @@ public:
     int jitterCorrectionLevel() const;
     bool isJitterCorrectionEnabled() const;
     bool tabletEnabled() const {return m_tabletEnabled; }
+    void compositeDirty();
+    const QImage &compositeImage() const;
+    const QImage &mipLevel(int level);
+    void setRenderedExternally(bool external);
 
     virtual QSize sizeHint () const;
     virtual QSize minimumSizeHint () const;
@@ -59,6 +72,12 @@ public slots:
     void saveLayers();
     QList<QImage> layerImages() const;
     void pause();
+    void undo();
+    void redo();
+    QString benchmarkBrush(int msecs = 1000);
+    QString benchmarkStrokes(int msecs = 300);
+    QString layerStorageStats() const;
+    QString simplifierStats() const;
 
 signals:
     void contentMovedBy(const QPoint&);
@@ -66,11 +85,13 @@ signals:
     void newBrushSettings(const QVariantMap &map);
     void historyComplete();
     void newPaintAction(const QVariantMap m);
+    void newStroke(const StrokeBuffer &stroke, const QVariantMap info);
     void requestSortedMembers(CanvasBackend::MemberSectionIndex index
                                = CanvasBackend::MemberSectionIndex::Count);
     void requestClearMembers();
     void canvasExported(const QPixmap& pic);
     void parsePaused();
+    void contentUpdated(const QRect &rect);
 protected:
     void mousePressEvent(QMouseEvent *event);
     void mouseMoveEvent(QMouseEvent *event);
@@ -84,31 +105,45 @@ protected:
     void focusOutEvent(QFocusEvent * event);
 
 private slots:
+    void remoteLayerInterned(int layer, const QString &name);
+    void remoteBrushChanged(const QVariantMap &brushSettings,
+                            int client);
     void remoteDrawPoint(const QPoint &point,
-                         const QVariantMap &brushSettings,
-                         const QString &layer,
-                         const QString clientid,
+                         int layer,
+                         int client,
                          const qreal pressure=1.0);
     void remoteDrawLine(const QPoint &start,
                         const QPoint &end,
-                        const QVariantMap &brushSettings,
-                        const QString &layer,
-                        const QString clientid,
+                        int layer,
+                        int client,
                         const qreal pressure=1.0);
+    void remoteStrokeEnded(int client);
+    void remoteRestoreTile(const QPoint &pos,
+                           const QImage &tile,
+                           const QImage &expected,
+                           const QString &layer,
+                           const QString clientid);
     void onMembersSorted(const QList<CanvasBackend::MemberSection> &list);
+    void scheduleFrame();
+    void flushFrame();
 
 private:
     void drawLineTo(const QPoint &endPoint, qreal pressure=1.0);
     void drawPoint(const QPoint &point, qreal pressure=1.0);
-    void storeAction(const QVariantMap& map);
-    void sendAction();
+    void sendAction(bool finished = true);
+    void sendRestore(const StrokeHistory::Step &step);
     void pickColor(const QPoint &point);
     void updateCursor();
-    void tryJitterCorrection();
     QImage appendAuthorSignature(QImage target);
     BrushPointer brushFactory(const QString &name);
     void setBrushFeature(const QString& key, const QVariant& value);
-    void drawAuthorTips(QPainter &painter, const QPoint &pos, const QString &name);
+    const QPixmap &authorTip(const QString &name);
+    void markDirty(const QRect &rect);
+    void markAllDirty();
+    void flushBrushes() const;
+    void flushOtherBrushes(const AbstractBrush *brush,
+                           const LayerPointer &layer) const;
+    const LayerPointer &remoteLayer(int id);
 
     enum CONTROL_MODE {
         UNKNOWN = -1,
@@ -123,21 +158,63 @@ private:
     QSize canvasSize;
     LayerManager layers;
     QImage image;
+    // changed areas of layers, not yet composited into image
+    QRegion dirty_;
+    // changed or exposed areas waiting for the next frame
+    QRegion repaint_;
+    QTimer frame_timer_;
+    QElapsedTimer frame_clock_;
+    int frame_interval_;
+    MipPyramid mip_;
+    bool external_render_;
+    FrameMetrics metrics_;
     QImage *currentImage;
     QPoint lastPoint;
-    QList<QPoint> stackPoints;
     int layerNameCounter;
     BrushPointer brush_;
     bool shareColor_;
     bool jitterCorrection_;
     int jitterCorrectionLevel_;
-    qreal jitterCorrectionLevel_internal_;
-    QHash<QString, BrushPointer> remoteBrush;
+    StrokeSimplifier simplifier_;
+    // remote layers and brushes, indexed by the ids CanvasBackend
+    // gives to layer names and clients
+    struct RemoteLayer
+    {
+        RemoteLayer():revision(-1){}
+        QString name;
+        LayerPointer layer;
+        int revision;
+    };
+    struct RemoteBrush
+    {
+        RemoteBrush():type(-1){}
+        int type;
+        BrushPointer brush;
+    };
+    QVector<RemoteLayer> remote_layers_;
+    QVector<RemoteBrush> remote_brushes_;
     QHash<QString, BrushPointer> localBrush;
     CanvasBackend* backend_;
     QThread *worker_;
+    LayerCompressor *compressor_;
+    LayerStore *store_;
     QList<CanvasBackend::MemberSection> author_list_;
-    QVariantList action_buffer_;
+    struct AuthorTip
+    {
+        QRect rect;
+        QPixmap pixmap;
+    };
+    // tips on screen keyed by client id, and rendered tips of the
+    // current members by name
+    QHash<QString, AuthorTip> author_tips_;
+    QHash<QString, QPixmap> tip_cache_;
+    StrokeBuffer stroke_;
+    StrokeBuffer spare_stroke_;
+    int stroke_id_;
+    int stroke_seq_;
+    int stream_interval_;
+    int stream_points_;
+    StrokeHistory history_;
 };
 
 #endif // CANVAS_H
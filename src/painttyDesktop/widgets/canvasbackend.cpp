@@ -2,21 +2,28 @@
 #include "../../common/network/clientsocket.h"
 #include "../misc/singleton.h"
 #include "../../common/common.h"
+#include "../misc/tilecodec.h"
 
 #include <QTimerEvent>
 #include <QDateTime>
 #include <QJsonDocument>
+#include <QJsonArray>
 #include <QSettings>
+#include <QDebug>
 
 #define client_socket (Singleton<ClientSocket>::instance())
 
+// settings sent recently, which strokes may refer to by id
+static const int MAX_SENT_BRUSHES = 16;
+
 CanvasBackend::CanvasBackend(QObject *parent)
     :QObject(parent),
       parse_timer_id_(0),
       archive_loaded_(false),
       is_parsed_signal_sent(false),
       pause_(false),
-      fullspeed_replay(false)
+      fullspeed_replay(false),
+      next_brush_id_(0)
 {
     parse_timer_id_ = this->startTimer(50);
 
@@ -73,6 +80,50 @@ void CanvasBackend::onDataBlock(const QVariantMap info)
     emit newDataGroup(data);
 }
 
+/*!
+    \fn void CanvasBackend::onStroke(const StrokeBuffer &stroke, const QVariantMap info)
+
+    Sends a local \a stroke as a "block" action, with \a info holding
+    the rest of the action. Points are written into JSON straight from
+    the buffer, without building a map per point.
+*/
+
+void CanvasBackend::onStroke(const StrokeBuffer &stroke, const QVariantMap info)
+{
+    // an empty chunk may still close a streamed stroke
+    if(stroke.isEmpty() && !info.contains("final")){
+        return;
+    }
+    QString author = info["name"].toString();
+    QString clientid = info["clientid"].toString();
+    upsertFootprint(clientid, author);
+
+    QJsonArray block;
+    for(int i = 0; i < stroke.count(); ++i){
+        QJsonObject point;
+        point.insert("x", stroke.x(i));
+        point.insert("y", stroke.y(i));
+        point.insert("pressure", stroke.pressure(i));
+        block.append(point);
+    }
+    QJsonObject obj(QJsonObject::fromVariantMap(info));
+    obj.insert("block", block);
+    if(info.contains("brush")){
+        bool known = false;
+        obj.insert("brush_id", internBrush(info["brush"].toMap(), &known));
+        // every stroke starts with the full settings, so those who
+        // joined since, or skipped the archive, can resolve the id
+        if(known && info["seq"].toInt() > 0){
+            obj.remove("brush");
+        }
+    }
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 1, 0))
+    emit newDataGroup(QJsonDocument(obj).toJson(QJsonDocument::Compact));
+#else
+    emit newDataGroup(QJsonDocument(obj).toJson());
+#endif
+}
+
 void CanvasBackend::onIncomingData(const QJsonObject& obj)
 {
     incoming_store_.enqueue(obj);
@@ -89,52 +140,103 @@ void CanvasBackend::parseIncoming()
         if(clientid == cached_clientid_){
             return;
         }
+        // streamed strokes arrive in chunks, each continuation starting
+        // with the point the previous chunk ended at. If we saw the
+        // stroke begin, the remote brush is already there.
+        bool resume = false;
+        // blocks of older clients are whole strokes
+        bool ends = true;
+        if(m.contains("stroke")){
+            int stroke = m["stroke"].toInt();
+            auto it = open_strokes_.constFind(clientid);
+            resume = m["seq"].toInt() > 0
+                    && it != open_strokes_.constEnd()
+                    && it.value() == stroke;
+            ends = m["final"].toBool();
+            if(ends){
+                open_strokes_.remove(clientid);
+            }else{
+                open_strokes_.insert(clientid, stroke);
+            }
+        }
+        // names are resolved here once per block,
+        // drawing signals only carry small ids
+        const int client = internClient(clientid);
         QVariantList list(m["block"].toList());
         if(list.length() < 1) {
+            if(ends){
+                emit remoteStrokeEnded(client);
+            }
             return;
         }
 
-        QString layerName(m["layer"].toString());
-        QVariantMap brushInfo(m["brush"].toMap());
+        const int layer = internLayer(m["layer"].toString());
+        applyRemoteBrush(client, m);
 
         // parse first point as drawpoint
-        QVariantMap first_set(list.takeFirst().toMap());
+        QVariantMap first_set(list.first().toMap());
         QPoint point(first_set.value("x", 0).toInt(), first_set.value("y", 0).toInt());
         qreal pressure = 1.0;
         if(first_set.contains("pressure")) {
             pressure = first_set.value("pressure").toDouble();
         }
-        QString author;
-        bool has_author = m.contains("name");
-        if(has_author){
-            author = m["name"].toString();
-            upsertFootprint(clientid, author, point);
-        }
 
-        emit remoteDrawPoint(point, brushInfo,
-                             layerName, clientid,
-                             pressure);
+        if(!resume){
+            emit remoteDrawPoint(point, layer,
+                                 client, pressure);
+        }
 
         // parse points as drawlines, with first point as start
         QPoint start_point(point);
         QPoint end_point;
         QVariantMap end;
-        while(list.length()){
-            end = list.takeFirst().toMap();
+        for(int i = 1; i < list.length(); ++i){
+            end = list[i].toMap();
             end_point.setX(end.value("x").toInt());
             end_point.setY(end.value("y").toInt());
             qreal pressure = 1.0;
             if(end.contains("pressure")) {
                 pressure = end.value("pressure").toDouble();
             }
-            if(has_author){
-                upsertFootprint(clientid, author, end_point);
-            }
             emit remoteDrawLine(start_point, end_point,
-                                brushInfo, layerName,
-                                clientid, pressure);
+                                layer, client,
+                                pressure);
             start_point = end_point;
         }
+        if(ends){
+            emit remoteStrokeEnded(client);
+        }
+
+        if(m.contains("name")){
+            upsertFootprint(clientid, m["name"].toString(),
+                            start_point, list.length());
+        }
+    };
+
+    // restore replaces regions with tiles sent by an undo or redo
+    auto restoreBlock = [this](const QVariantMap& m){
+        QString clientid(m["clientid"].toString());
+        if(clientid == cached_clientid_){
+            return;
+        }
+        QString layerName(m["layer"].toString());
+        QVariantList list(m["tiles"].toList());
+        for(const QVariant &item: list){
+            QVariantMap tile(item.toMap());
+            QImage image = decodeTile(QByteArray::fromBase64(
+                                          tile["data"].toString().toLatin1()));
+            if(image.isNull()){
+                continue;
+            }
+            // older clients send no expected tile, and restore it whole
+            QImage expected = decodeTile(QByteArray::fromBase64(
+                                             tile["expected"].toString().toLatin1()));
+            QPoint pos(tile.value("x", 0).toInt(), tile.value("y", 0).toInt());
+            emit remoteRestoreTile(pos, image, expected, layerName, clientid);
+        }
+        if(m.contains("name")){
+            upsertFootprint(clientid, m["name"].toString());
+        }
     };
 
     static bool need_repaint = false;
@@ -149,6 +251,8 @@ void CanvasBackend::parseIncoming()
             }else{
                 emit repaintHint();
             }
+        }else if(action == "restore"){
+            restoreBlock(obj.toVariantMap());
         }
     }else{
         if(need_repaint){
@@ -188,23 +292,134 @@ void CanvasBackend::requestMembers(MSI index)
 void CanvasBackend::clearMembers()
 {
     memberHistory_.clear();
+    open_strokes_.clear();
+    // the archive is gone, so are the settings sent into it
+    sent_brushes_.clear();
+}
+
+/*!
+    \fn int CanvasBackend::internBrush(const QVariantMap &settings, bool *known)
+
+    Returns the id that local strokes use for brush \a settings.
+    \a known tells whether the settings were sent with that id before.
+    The first chunk of a stroke carries them anyway; only the chunks
+    that continue it may leave them out once they are known.
+*/
+
+int CanvasBackend::internBrush(const QVariantMap &settings, bool *known)
+{
+    for(int i = 0; i < sent_brushes_.count(); ++i){
+        if(sent_brushes_[i].second == settings){
+            *known = true;
+            sent_brushes_.move(i, 0);
+            return sent_brushes_.first().first;
+        }
+    }
+    *known = false;
+    // ids are never reused, so a receiver never holds a stale one
+    const int id = next_brush_id_++;
+    sent_brushes_.prepend(qMakePair(id, settings));
+    if(sent_brushes_.count() > MAX_SENT_BRUSHES){
+        sent_brushes_.removeLast();
+    }
+    return id;
+}
+
+/*!
+    \fn void CanvasBackend::applyRemoteBrush(int client, const QVariantMap &m)
+
+    Resolves the brush of block \a m sent by \a client, and emits
+    remoteBrushChanged() only if it differs from the one in use.
+    Blocks from older clients carry the full settings instead of an id.
+    An id that was defined before we joined keeps the last full
+    settings of the client, which the start of its stroke carried.
+*/
+
+void CanvasBackend::applyRemoteBrush(int client, const QVariantMap &m)
+{
+    BrushTable &table = brush_tables_[client];
+    QVariantMap settings;
+    if(m.contains("brush_id")){
+        const int id = m["brush_id"].toInt();
+        const bool defined = m.contains("brush");
+        if(!defined && id == table.active){
+            return;
+        }
+        if(defined){
+            table.settings.insert(id, m["brush"].toMap());
+        }
+        auto it = table.settings.constFind(id);
+        if(it == table.settings.constEnd()){
+            // fall back to the last full settings, and remember them
+            // under this id until the next stroke brings its own
+            if(table.current.isEmpty()){
+                qWarning()<<"Unknown brush"<<id<<"from"<<client_names_[client];
+                return;
+            }
+            it = table.settings.insert(id, table.current);
+        }
+        table.active = id;
+        settings = it.value();
+    }else{
+        table.active = -1;
+        settings = m["brush"].toMap();
+    }
+    if(settings == table.current){
+        return;
+    }
+    table.current = settings;
+    emit remoteBrushChanged(settings, client);
+}
+
+int CanvasBackend::internClient(const QString &clientid)
+{
+    auto it = client_ids_.constFind(clientid);
+    if(it != client_ids_.constEnd()){
+        return it.value();
+    }
+    const int id = client_names_.count();
+    client_ids_.insert(clientid, id);
+    client_names_.append(clientid);
+    brush_tables_.append(BrushTable());
+    return id;
+}
+
+/*!
+    \fn int CanvasBackend::internLayer(const QString &name)
+
+    Returns the id of layer \a name. The first time a name is seen,
+    remoteLayerInterned() tells the canvas which name the id stands for,
+    before any drawing refers to it.
+*/
+
+int CanvasBackend::internLayer(const QString &name)
+{
+    auto it = layer_ids_.constFind(name);
+    if(it != layer_ids_.constEnd()){
+        return it.value();
+    }
+    const int id = layer_ids_.count();
+    layer_ids_.insert(name, id);
+    emit remoteLayerInterned(id, name);
+    return id;
 }
 
 void CanvasBackend::upsertFootprint(const QString& id,
                                     const QString& name,
-                                    const QPoint& point)
+                                    const QPoint& point,
+                                    quint64 count)
 {
     qint64 stamp = QDateTime::currentMSecsSinceEpoch();
     if( memberHistory_.contains(id) ) {
         auto& member = memberHistory_[id];
-        std::get<MSI::Count>( member )++;
+        std::get<MSI::Count>( member ) += count;
         std::get<MSI::Footprint>( member ) = point;
         std::get<MSI::Name>( member ) = name;
         std::get<MSI::LastActiveStamp>( member ) = stamp;
     }else{
         memberHistory_.insert(id, MemberSection(id,
                                                 name,
-                                                1,
+                                                count,
                                                 point,
                                                 stamp));
     }
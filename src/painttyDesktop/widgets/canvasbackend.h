@@ -3,11 +3,14 @@
 
 #include <QObject>
 #include <QHash>
+#include <QVector>
 #include <QQueue>
 #include <QJsonObject>
 #include <QVariantList>
 #include <QByteArray>
 #include <QPoint>
+#include <QImage>
+#include "../misc/strokebuffer.h"
 
 class CanvasBackend : public QObject
 {
@@ -27,6 +30,7 @@ public:
     ~CanvasBackend();
 public slots:
     void onDataBlock(const QVariantMap d);
+    void onStroke(const StrokeBuffer &stroke, const QVariantMap info);
     void onIncomingData(const QJsonObject &d);
     void requestMembers(MemberSectionIndex index);
     void clearMembers();
@@ -34,17 +38,24 @@ public slots:
     void resumeParse();
 signals:
     void newDataGroup(const QByteArray& d);
+    void remoteLayerInterned(int layer, const QString &name);
+    void remoteBrushChanged(const QVariantMap &brushInfo,
+                            int client);
     void remoteDrawPoint(const QPoint &point,
-                         const QVariantMap &brushInfo,
-                         const QString &layer,
-                         const QString clientid,
+                         int layer,
+                         int client,
                          const qreal pressure=1.0);
     void remoteDrawLine(const QPoint &start,
                         const QPoint &end,
-                        const QVariantMap &brushInfo,
-                        const QString &layer,
-                        const QString clientid,
+                        int layer,
+                        int client,
                         const qreal pressure=1.0);
+    void remoteStrokeEnded(int client);
+    void remoteRestoreTile(const QPoint &pos,
+                           const QImage &tile,
+                           const QImage &expected,
+                           const QString &layer,
+                           const QString clientid);
     void repaintHint();
     void membersSorted(QList<MemberSection> list);
     void archiveParsed();
@@ -55,14 +66,38 @@ private:
     // Warning, access memberHistory_ across thread
     // via member functions is not thread-safe
     QHash<QString, MemberSection> memberHistory_;
+    // id of the stroke each client is streaming
+    QHash<QString, int> open_strokes_;
+    // brush settings are sent once with an id, and referred to by it
+    // later on. Remote tables are kept per client.
+    struct BrushTable
+    {
+        BrushTable():active(-1){}
+        int active;
+        QVariantMap current;
+        QHash<int, QVariantMap> settings;
+    };
+    // indexed by client id
+    QVector<BrushTable> brush_tables_;
+    QList<QPair<int, QVariantMap> > sent_brushes_;
+    int next_brush_id_;
+    // names of remote clients and layers, interned to small ids
+    QHash<QString, int> client_ids_;
+    QVector<QString> client_names_;
+    QHash<QString, int> layer_ids_;
     QString cached_clientid_;
     int parse_timer_id_;
     bool archive_loaded_;
     bool is_parsed_signal_sent;
     bool pause_;
     bool fullspeed_replay;
-    void upsertFootprint(const QString& id, const QString& name, const QPoint &point);
+    void upsertFootprint(const QString& id, const QString& name,
+                         const QPoint &point, quint64 count = 1);
     void upsertFootprint(const QString& id, const QString& name);
+    int internBrush(const QVariantMap &settings, bool *known);
+    void applyRemoteBrush(int client, const QVariantMap &m);
+    int internClient(const QString &clientid);
+    int internLayer(const QString &name);
     QByteArray toJson(const QVariant &m);
     QVariant fromJson(const QByteArray &d);
     void parseIncoming();
@@ -1,6 +1,8 @@
 #include <QGraphicsScene>
 #include "canvascontainer.h"
 #include "canvas.h"
+#include "canvasrenderitem.h"
+#include "../misc/framemetrics.h"
 #include <QGraphicsProxyWidget>
 #include <QApplication>
 #include <QScrollBar>
@@ -8,6 +10,7 @@
 #include <QLabel>
 #include <QHBoxLayout>
 #include <QSettings>
+#include <QStringList>
 #include <qmath.h>
 #include <QDebug>
 
@@ -17,7 +20,7 @@ using GlobalDef::MAX_SCALE_FACTOR;
 using GlobalDef::MIN_SCALE_FACTOR;
 
 CanvasContainer::CanvasContainer(QWidget *parent) :
-    QGraphicsView(parent), proxy(0),
+    QGraphicsView(parent), proxy(0), renderItem(0),
     smoothScaleFlag(true)
 {
     setCacheMode(QGraphicsView::CacheBackground);
@@ -45,10 +48,81 @@ void CanvasContainer::setCanvas(QWidget *canvas)
         canvas->setWindowFlags(canvas->windowFlags() | Qt::Window);
     }
     proxy = scene->addWidget(canvas);
+
+    // The tiled renderer draws the canvas behind its proxy, so the proxy
+    // no longer renders the full canvas before it is transformed.
+    // canvas/legacy_renderer falls back to the proxy path.
+    Canvas *c = qobject_cast<Canvas*>(canvas);
+    QSettings settings(GlobalDef::SETTINGS_NAME,
+                       QSettings::defaultFormat(),
+                       qApp);
+    if(c && !settings.value("canvas/legacy_renderer", false).toBool()){
+        renderItem = new CanvasRenderItem(c, proxy);
+        renderItem->setFlag(QGraphicsItem::ItemStacksBehindParent);
+        c->setRenderedExternally(true);
+    }
     canvas->installEventFilter(this);
     viewport()->installEventFilter(this); //at this time, viewport is available, so we intall event filter to send tablet event
 }
 
+/*!
+    \fn QString CanvasContainer::benchmarkRenderers(int frames)
+
+    Repaints the view \a frames times with the legacy renderer, where the
+    proxy renders the whole canvas before it is transformed, and then
+    with CanvasRenderItem. Each is measured twice: at the current zoom
+    and rotation, and while the rotation flips by one degree every
+    frame, which drops the tile cache each time. Returns what
+    FrameMetrics measured for each run.
+
+    Zoom and rotate a large canvas first, e.g. 8k at 30 degrees. Meant
+    to be called from the script console:
+    mainwindow.centralWidget.benchmarkRenderers().
+*/
+
+QString CanvasContainer::benchmarkRenderers(int frames)
+{
+    Canvas *c = proxy ? qobject_cast<Canvas*>(proxy->widget()) : 0;
+    if(!c || frames < 1){
+        return QString();
+    }
+    const bool tiled = renderItem;
+    if(!tiled){
+        renderItem = new CanvasRenderItem(c, proxy);
+        renderItem->setFlag(QGraphicsItem::ItemStacksBehindParent);
+    }
+    const qreal rotation = proxy->rotation();
+    QStringList results;
+    for(bool rotating: {false, true}){
+        for(bool legacy: {true, false}){
+            renderItem->setVisible(!legacy);
+            c->setRenderedExternally(!legacy);
+            FrameMetrics metrics(QString("%1 renderer, %2")
+                                 .arg(legacy ? "legacy" : "tiled")
+                                 .arg(rotating ? "rotating" : "still"),
+                                 0);
+            metrics.setEnabled(true);
+            for(int i = 0; i < frames; ++i){
+                if(rotating){
+                    proxy->setRotation(rotation + (i & 1));
+                }
+                metrics.begin();
+                viewport()->repaint();
+                metrics.end();
+            }
+            results.append(metrics.toString());
+        }
+    }
+    proxy->setRotation(rotation);
+    renderItem->setVisible(tiled);
+    c->setRenderedExternally(tiled);
+    if(!tiled){
+        delete renderItem;
+        renderItem = 0;
+    }
+    return results.join("\n");
+}
+
 void CanvasContainer::setScaleFactor(qreal factor)
 {
     //new signal and slot syntax has some trouble
@@ -5,6 +5,7 @@
 
 class QGraphicsScene;
 class QGraphicsProxyWidget;
+class CanvasRenderItem;
 
 class CanvasContainer : public QGraphicsView
 {
@@ -31,10 +32,12 @@ public slots:
     void scaleBy(qreal factor);
     void setRotation(int degree);
     void rotateBy(int deg);
+    QString benchmarkRenderers(int frames = 120);
 
 private:
     QGraphicsScene *scene;
     QGraphicsProxyWidget *proxy;
+    CanvasRenderItem *renderItem;
     QPoint moveStartPoint;
     bool smoothScaleFlag;
     qreal calculateFactor(qreal current, bool zoomIn);
@@ -0,0 +1,163 @@
+#include "canvasrenderitem.h"
+#include "canvas.h"
+#include "../misc/mippyramid.h"
+
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
+#include <QSettings>
+#include <qmath.h>
+
+#include "../../common/common.h"
+
+/*!
+    \class CanvasRenderItem
+
+    \brief Draws the canvas into the view, tile by tile.
+
+    The item sits behind the proxy of Canvas and shares its transform,
+    while Canvas itself only paints overlays. Only tiles under the
+    exposed rect, which the view already culls to the viewport, are
+    drawn.
+
+    Each tile is transformed into device pixels once, from the mip
+    level matching the zoom, and kept in a cache. While rotation and
+    zoom stay the same, panning and repaints just blit cached tiles.
+    A transform change drops the cache, and changed canvas areas drop
+    the tiles under them.
+*/
+
+CanvasRenderItem::CanvasRenderItem(Canvas *canvas, QGraphicsItem *parent)
+    :QGraphicsObject(parent),
+      canvas_(canvas),
+      smooth_(true),
+      metrics_("tiled renderer")
+{
+    setFlag(QGraphicsItem::ItemUsesExtendedStyleOption);
+    setAcceptedMouseButtons(Qt::NoButton);
+
+    QSettings settings(GlobalDef::SETTINGS_NAME,
+                       QSettings::defaultFormat());
+    metrics_.setEnabled(settings.value("canvas/frame_metrics",
+                                       false).toBool());
+    setCacheSize(settings.value("canvas/render_cache", 256*1024).toInt());
+
+    connect(canvas, &Canvas::contentUpdated,
+            this, &CanvasRenderItem::invalidate);
+}
+
+QRectF CanvasRenderItem::boundingRect() const
+{
+    return QRectF(QPointF(0, 0), canvas_->size());
+}
+
+void CanvasRenderItem::setCacheSize(int kilobytes)
+{
+    cache_.setMaxCost(kilobytes);
+}
+
+void CanvasRenderItem::invalidate(const QRect &rect)
+{
+    if(cache_.isEmpty()){
+        return;
+    }
+    const int columns = (canvas_->width() + TILE_SIZE - 1) / TILE_SIZE;
+    const QRect area = rect.intersected(QRect(QPoint(0, 0), canvas_->size()));
+    if(area.isEmpty()){
+        return;
+    }
+    for(int ty = area.top() / TILE_SIZE; ty <= area.bottom() / TILE_SIZE; ++ty){
+        for(int tx = area.left() / TILE_SIZE; tx <= area.right() / TILE_SIZE; ++tx){
+            cache_.remove(ty * columns + tx);
+        }
+    }
+}
+
+CanvasRenderItem::Tile CanvasRenderItem::renderTile(const QRect &rect,
+                                                    int level) const
+{
+    const QRectF bounds = linear_.mapRect(QRectF(rect)).translated(fraction_);
+    const QRect target = bounds.toAlignedRect();
+
+    Tile tile;
+    tile.offset = target.topLeft();
+    tile.image = QImage(target.size(), QImage::Format_ARGB32_Premultiplied);
+    tile.image.fill(Qt::transparent);
+
+    QPainter painter(&tile.image);
+    // NOTICE: no antialiasing, so that neighbour tiles meet without seams
+    painter.setRenderHint(QPainter::SmoothPixmapTransform, smooth_);
+    painter.setTransform(linear_
+                         * QTransform::fromTranslate(fraction_.x() - target.x(),
+                                                     fraction_.y() - target.y()));
+    if(level > 0){
+        const qreal f = 1 << level;
+        painter.drawImage(QRectF(rect), canvas_->mipLevel(level),
+                          QRectF(rect.x() / f, rect.y() / f,
+                                 rect.width() / f, rect.height() / f));
+    }else{
+        painter.drawImage(rect.topLeft(), canvas_->compositeImage(), rect);
+    }
+    return tile;
+}
+
+void CanvasRenderItem::paint(QPainter *painter,
+                             const QStyleOptionGraphicsItem *option,
+                             QWidget *)
+{
+    metrics_.begin();
+    // brings the composite up to date, and drops changed tiles
+    canvas_->compositeDirty();
+
+    const QRect canvasRect(QPoint(0, 0), canvas_->size());
+    const QRect exposed = option->exposedRect.toAlignedRect()
+            .intersected(canvasRect);
+    const QTransform world = painter->worldTransform();
+    if(exposed.isEmpty()){
+        metrics_.end();
+        return;
+    }
+    if(world.type() <= QTransform::TxTranslate
+            || world.type() == QTransform::TxProject){
+        // nothing to cache at 1:1, and projections never happen here
+        painter->drawImage(exposed, canvas_->compositeImage(), exposed);
+        metrics_.end();
+        return;
+    }
+
+    const QTransform linear(world.m11(), world.m12(),
+                            world.m21(), world.m22(), 0, 0);
+    const QPoint translation(qFloor(world.dx()), qFloor(world.dy()));
+    const QPointF fraction(world.dx() - translation.x(),
+                           world.dy() - translation.y());
+    const bool smooth = painter->testRenderHint(QPainter::SmoothPixmapTransform);
+    if(linear != linear_ || fraction != fraction_ || smooth != smooth_){
+        cache_.clear();
+        linear_ = linear;
+        fraction_ = fraction;
+        smooth_ = smooth;
+    }
+    const int level = MipPyramid::levelFor(qSqrt(qAbs(linear.determinant())));
+
+    painter->save();
+    painter->setWorldTransform(QTransform::fromTranslate(translation.x(),
+                                                         translation.y()));
+    const int columns = (canvasRect.width() + TILE_SIZE - 1) / TILE_SIZE;
+    for(int ty = exposed.top() / TILE_SIZE; ty <= exposed.bottom() / TILE_SIZE; ++ty){
+        for(int tx = exposed.left() / TILE_SIZE; tx <= exposed.right() / TILE_SIZE; ++tx){
+            const quint32 key = ty * columns + tx;
+            Tile *cached = cache_.object(key);
+            if(cached){
+                painter->drawImage(cached->offset, cached->image);
+                continue;
+            }
+            const QRect rect = QRect(tx * TILE_SIZE, ty * TILE_SIZE,
+                                     TILE_SIZE, TILE_SIZE)
+                    .intersected(canvasRect);
+            Tile *tile = new Tile(renderTile(rect, level));
+            painter->drawImage(tile->offset, tile->image);
+            cache_.insert(key, tile, qMax(1, tile->image.byteCount() / 1024));
+        }
+    }
+    painter->restore();
+    metrics_.end();
+}
@@ -0,0 +1,47 @@
+#ifndef CANVASRENDERITEM_H
+#define CANVASRENDERITEM_H
+
+#include <QGraphicsObject>
+#include <QCache>
+#include <QTransform>
+#include "../misc/framemetrics.h"
+
+class Canvas;
+
+class CanvasRenderItem : public QGraphicsObject
+{
+    Q_OBJECT
+public:
+    enum : int {
+        TILE_SIZE = 256
+    };
+
+    CanvasRenderItem(Canvas *canvas, QGraphicsItem *parent = nullptr);
+    QRectF boundingRect() const Q_DECL_OVERRIDE;
+    void paint(QPainter *painter,
+               const QStyleOptionGraphicsItem *option,
+               QWidget *widget = nullptr) Q_DECL_OVERRIDE;
+    void setCacheSize(int kilobytes);
+
+public slots:
+    void invalidate(const QRect &rect);
+
+private:
+    // a tile already transformed into device pixels
+    struct Tile
+    {
+        QImage image;
+        QPoint offset;
+    };
+    Tile renderTile(const QRect &rect, int level) const;
+
+    Canvas *canvas_;
+    QCache<quint32, Tile> cache_;
+    // what the cached tiles were rendered with
+    QTransform linear_;
+    QPointF fraction_;
+    bool smooth_;
+    FrameMetrics metrics_;
+};
+
+#endif // CANVASRENDERITEM_H
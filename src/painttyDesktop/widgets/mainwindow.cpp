@@ -143,6 +143,8 @@ void MainWindow::init()
             this, &MainWindow::onColorGridPicked);
     connect(ui->panorama, &PanoramaWidget::refresh,
             this, &MainWindow::onPanoramaRefresh);
+    connect(ui->canvas, &Canvas::contentUpdated,
+            ui->panorama, &PanoramaWidget::onContentChange);
     connect(ui->centralWidget, &CanvasContainer::rectChanged,
             ui->panorama, &PanoramaWidget::onRectChange);
     connect(ui->panorama, &PanoramaWidget::moveTo,
@@ -192,6 +194,18 @@ void MainWindow::layerWidgetInit()
     }
     ui->layerWidget->itemAt(0)->setSelect(true);
     ui->canvas->loadLayers();
+
+    QSettings settings(GlobalDef::SETTINGS_NAME,
+                       QSettings::defaultFormat(),
+                       qApp);
+    if(settings.value("canvas/skip_replay", true).toBool()){
+        // checkpoint often, so little is left to write on close
+        QTimer *checkpoint = new QTimer(this);
+        connect(checkpoint, &QTimer::timeout,
+                ui->canvas, &Canvas::saveLayers);
+        checkpoint->start(settings.value("canvas/checkpoint_interval", 120)
+                          .toInt() * 1000);
+    }
 }
 
 void MainWindow::colorGridInit()
@@ -546,6 +560,12 @@ void MainWindow::shortcutInit()
         this->ui->centralWidget->setRotation(0);
         this->ui->centralWidget->setScaleFactor(1);
     });
+    regShortcut<>("undo", [this](){
+        this->ui->canvas->undo();
+    });
+    regShortcut<>("redo", [this](){
+        this->ui->canvas->redo();
+    });
     regShortcut<>(QKeySequence("F12"),
                   std::bind(&MainWindow::openConsole, this));
 }
@@ -742,8 +762,19 @@ void MainWindow::onBrushSettingsChanged(const QVariantMap &m)
 
 void MainWindow::onPanoramaRefresh()
 {
-    ui->panorama->onImageChange(ui->canvas->grab(),
-                                ui->centralWidget->visualRect().toRect());
+    // the smallest level still as large as the thumbnail is sharp
+    // enough, and cheap to keep fresh
+    const QSize canvas_size = ui->canvas->size();
+    const QSize thumb = ui->panorama->thumbnailSize(canvas_size);
+    int level = 0;
+    while(level + 1 < MipPyramid::MAX_LEVELS
+          && (canvas_size.width() >> (level + 1)) >= thumb.width()
+          && (canvas_size.height() >> (level + 1)) >= thumb.height()){
+        ++level;
+    }
+    ui->canvas->compositeDirty();
+    ui->panorama->onImageChange(ui->canvas->mipLevel(level), canvas_size);
+    ui->panorama->onRectChange(ui->centralWidget->visualRect().toRect());
 }
 
 void MainWindow::onMoveToolPressed(bool c)
@@ -5,24 +5,33 @@
 #include <QPainter>
 #include <QDebug>
 
+/*!
+    \class PanoramaView
+
+    The thumbnail follows canvas changes instead of polling. Changed
+    areas are collected from Canvas::contentUpdated() and, after a short
+    delay to coalesce bursts, refresh() asks for the smallest mip level
+    of the composite that is no smaller than the thumbnail. Only the
+    thumbnail areas under the changes are then redrawn from it.
+*/
+
 PanoramaView::PanoramaView(QWidget *parent) :
     QWidget(parent),
     preferSize_(144, 96),
     image_( preferSize_ ),
-    full_img_(preferSize_),
-    sized_img_(preferSize_)
+    sized_img_(preferSize_, QImage::Format_ARGB32_Premultiplied),
+    full_refresh_(true)
 {
     QPalette p = this->palette();
     p.setColor(QPalette::Background, Qt::gray);
     this->setPalette(p);
     sized_img_.fill(Qt::white);
-    full_img_.fill(Qt::white);
     image_.fill(Qt::white);
-    timer_.setInterval(2*1000);
+    timer_.setInterval(200);
+    timer_.setSingleShot(true);
     connect(&timer_, &QTimer::timeout,
             this, &PanoramaView::refresh);
     timer_.start();
-    emit refresh();
 }
 
 QSize PanoramaView::sizeHint() const
@@ -35,16 +44,62 @@ QSize PanoramaView::minimumSizeHint() const
     return QSize(144, 96);
 }
 
-void PanoramaView::onImageChange(const QPixmap &p,
-                                   const QRect &r)
+/*!
+    \fn QSize PanoramaView::thumbnailSize(const QSize &canvasSize) const
+
+    Returns the size of the thumbnail of a canvas of \a canvasSize,
+    the largest that fits the view and keeps the aspect ratio.
+*/
+
+QSize PanoramaView::thumbnailSize(const QSize &canvasSize) const
 {
-    full_img_ = p;
-    viewport_ = r;
-    thumbnail();
+    if(canvasSize.isEmpty()){
+        return QSize();
+    }
+    qreal delta = qMin(qreal(preferSize_.width()) / canvasSize.width(),
+                       qreal(preferSize_.height()) / canvasSize.height());
+    return QSize(canvasSize.width() * delta, canvasSize.height() * delta);
+}
+
+void PanoramaView::onImageChange(const QImage &level,
+                                 const QSize &canvasSize)
+{
+    if(level.isNull() || canvasSize.isEmpty()){
+        return;
+    }
+    if(canvasSize != canvas_size_){
+        canvas_size_ = canvasSize;
+        full_refresh_ = true;
+    }
+    if(full_refresh_){
+        thumbnail(level, QRect(QPoint(0, 0), canvasSize));
+    }else{
+        for(const QRect &rect: dirty_.rects()){
+            thumbnail(level, rect);
+        }
+    }
+    full_refresh_ = false;
+    dirty_ = QRegion();
+    // changes composited just for this refresh are already in
+    timer_.stop();
     image_ = drawViewport();
     update();
 }
 
+void PanoramaView::onContentChange(const QRect &r)
+{
+    dirty_ |= r;
+    requestRefresh();
+}
+
+void PanoramaView::requestRefresh()
+{
+    // coalesce changes, a stroke emits many of them
+    if(!timer_.isActive()){
+        timer_.start();
+    }
+}
+
 void PanoramaView::onRectChange(const QRect &r)
 {
     viewport_ = r;
@@ -54,8 +109,8 @@ void PanoramaView::onRectChange(const QRect &r)
 
 QPixmap PanoramaView::drawViewport()
 {
-    QPixmap p = sized_img_;
-    if(p.isNull()){
+    QPixmap p = QPixmap::fromImage(sized_img_);
+    if(p.isNull() || canvas_size_.isEmpty()){
         return p;
     }
     const QRect &r = viewport_;
@@ -64,7 +119,7 @@ QPixmap PanoramaView::drawViewport()
     pen.setColor(this->palette().color(QPalette::Text));
     pen.setWidth(1);
     painter.setPen(pen);
-    qreal delta = p.width()/qreal(full_img_.width());
+    qreal delta = p.width()/qreal(canvas_size_.width());
     QPointF topleft(r.topLeft() * delta);
     QRect thumbRect = QRectF(topleft,
                              r.size() * delta).toRect();
@@ -75,17 +130,47 @@ QPixmap PanoramaView::drawViewport()
     return p;
 }
 
-void PanoramaView::thumbnail()
+/*!
+    \fn void PanoramaView::thumbnail(const QImage &level, const QRect &rect)
+
+    Redraws the part of the thumbnail under \a rect, given in canvas
+    coordinates, from \a level, a downsampled copy of the canvas.
+*/
+
+void PanoramaView::thumbnail(const QImage &level, const QRect &rect)
 {
-    if(full_img_.isNull()){
+    const QSize size = thumbnailSize(canvas_size_);
+    if(size.isEmpty()){
+        return;
+    }
+    const qreal delta = qreal(size.width()) / canvas_size_.width();
+    if(sized_img_.size() != size){
+        sized_img_ = QImage(size, QImage::Format_ARGB32_Premultiplied);
+        sized_img_.fill(Qt::white);
+        if(rect.size() != canvas_size_){
+            thumbnail(level, QRect(QPoint(0, 0), canvas_size_));
+            return;
+        }
+    }
+
+    // thumbnail pixels touched by rect, and the level pixels under them
+    QRect target = QRectF(rect.x() * delta, rect.y() * delta,
+                          rect.width() * delta, rect.height() * delta)
+            .toAlignedRect().intersected(sized_img_.rect());
+    if(target.isEmpty()){
         return;
     }
-    qreal delta = qMin(qreal(preferSize_.width()) / full_img_.width(),
-                       qreal(preferSize_.height()) / full_img_.height());
-    sized_img_ = full_img_.scaled(full_img_.width() * delta,
-                                  full_img_.height() * delta,
-                                  Qt::IgnoreAspectRatio,
-                                  Qt::SmoothTransformation);
+    qreal ratio = qreal(level.width()) / size.width();
+    QRect source = QRectF(target.x() * ratio, target.y() * ratio,
+                          target.width() * ratio, target.height() * ratio)
+            .toAlignedRect().intersected(level.rect());
+
+    QPainter painter(&sized_img_);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.drawImage(target.topLeft(),
+                      level.copy(source).scaled(target.size(),
+                                                Qt::IgnoreAspectRatio,
+                                                Qt::SmoothTransformation));
 }
 
 void PanoramaView::paintEvent(QPaintEvent *)
@@ -102,14 +187,8 @@ void PanoramaView::paintEvent(QPaintEvent *)
 void PanoramaView::resizeEvent(QResizeEvent * event)
 {
     preferSize_ = event->size();
-    if(image_.isNull()){
-        return;
-    }
-    thumbnail();
-    image_ = drawViewport();
-    if(this->isVisible()){
-        update();
-    }
+    full_refresh_ = true;
+    requestRefresh();
 }
 
 void PanoramaView::navigateTo(const QPoint &p)
@@ -120,7 +199,10 @@ void PanoramaView::navigateTo(const QPoint &p)
     int top = whole.height() - image_.height();
     top /= 2;
 
-    qreal delta = qreal(full_img_.width())/sized_img_.width();
+    if(sized_img_.width() <= 0){
+        return;
+    }
+    qreal delta = qreal(canvas_size_.width())/sized_img_.width();
     QPointF miniPoint(p-QPoint(left, top));
     QPointF realPoint = miniPoint * delta;
 
@@ -3,6 +3,7 @@
 
 #include <QWidget>
 #include <QTimer>
+#include <QRegion>
 
 class PanoramaView : public QWidget
 {
@@ -11,12 +12,14 @@ public:
     explicit PanoramaView(QWidget *parent = 0);
     QSize sizeHint() const;
     QSize minimumSizeHint() const;
+    QSize thumbnailSize(const QSize &canvasSize) const;
 signals:
     void refresh();
     void moveTo(const QPointF &p);
     void viewportChange(const QRectF &r);
 public slots:
-    void onImageChange(const QPixmap &p, const QRect &r);
+    void onImageChange(const QImage &level, const QSize &canvasSize);
+    void onContentChange(const QRect &r);
     void onRectChange(const QRect &r);
 protected:
     void paintEvent(QPaintEvent *);
@@ -26,12 +29,16 @@ protected:
 private:
     QSize preferSize_;
     QPixmap image_;
-    QPixmap full_img_;
-    QPixmap sized_img_;
+    QImage sized_img_;
+    QSize canvas_size_;
+    // canvas areas changed since the thumbnail was last refreshed
+    QRegion dirty_;
+    bool full_refresh_;
     QTimer timer_;
     QRect viewport_;
     QPixmap drawViewport();
-    void thumbnail();
+    void thumbnail(const QImage &level, const QRect &rect);
+    void requestRefresh();
     void navigateTo(const QPoint &p);
 };
 
@@ -50,11 +50,22 @@ void PanoramaWidget::setRotation(int d)
     }
 }
 
-void PanoramaWidget::onImageChange(const QPixmap &p,
-                                   const QRect &r)
+QSize PanoramaWidget::thumbnailSize(const QSize &canvasSize) const
+{
+    return view ? view->thumbnailSize(canvasSize) : QSize();
+}
+
+void PanoramaWidget::onImageChange(const QImage &level,
+                                   const QSize &canvasSize)
+{
+    if(view)
+        view->onImageChange(level, canvasSize);
+}
+
+void PanoramaWidget::onContentChange(const QRect &r)
 {
     if(view)
-        view->onImageChange(p,r);
+        view->onContentChange(r);
 }
 
 void PanoramaWidget::onRectChange(const QRect &r)
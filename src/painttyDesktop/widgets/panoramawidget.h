@@ -12,6 +12,7 @@ class PanoramaWidget : public QWidget
     Q_OBJECT
 public:
     explicit PanoramaWidget(QWidget *parent = 0);
+    QSize thumbnailSize(const QSize &canvasSize) const;
 signals:
     void refresh();
     void moveTo(const QPointF &p);
@@ -21,7 +22,8 @@ signals:
 public slots:
     void setScaled(qreal);
     void setRotation(int);
-    void onImageChange(const QPixmap &p, const QRect &r);
+    void onImageChange(const QImage &level, const QSize &canvasSize);
+    void onContentChange(const QRect &r);
     void onRectChange(const QRect &r);
 private:
     PanoramaSlider *slider;
@@ -0,0 +1,59 @@
+#-------------------------------------------------
+#
+# Brush benchmark and golden image test
+#
+#-------------------------------------------------
+
+QT       += core gui widgets testlib
+
+include(../../commonconfigure.pri)
+
+CONFIG += c++11 testcase
+
+TARGET = tst_brushbenchmark
+TEMPLATE = app
+
+DESKTOP = ../../src/painttyDesktop
+
+DEFINES += GOLDEN_DIR=\\\"$$PWD/golden\\\"
+
+SOURCES += tst_brushbenchmark.cpp \
+    $$DESKTOP/misc/brushbenchmark.cpp \
+    $$DESKTOP/misc/layer.cpp \
+    $$DESKTOP/misc/tilecodec.cpp \
+    $$DESKTOP/misc/strokebuffer.cpp \
+    $$DESKTOP/misc/shortcutmanager.cpp \
+    $$DESKTOP/paintingTools/brush/brushmanager.cpp \
+    $$DESKTOP/paintingTools/brush/abstractbrush.cpp \
+    $$DESKTOP/paintingTools/brush/basicbrush.cpp \
+    $$DESKTOP/paintingTools/brush/basiceraser.cpp \
+    $$DESKTOP/paintingTools/brush/binarybrush.cpp \
+    $$DESKTOP/paintingTools/brush/brushfeature.cpp \
+    $$DESKTOP/paintingTools/brush/maskbased.cpp \
+    $$DESKTOP/paintingTools/brush/sketchbrush.cpp \
+    $$DESKTOP/paintingTools/brush/waterbased.cpp \
+    $$DESKTOP/paintingTools/brush/dabblitter.cpp \
+    $$DESKTOP/paintingTools/brush/capsulerasterizer.cpp \
+    $$DESKTOP/paintingTools/brush/strokewash.cpp
+
+HEADERS += $$DESKTOP/misc/brushbenchmark.h \
+    $$DESKTOP/misc/layer.h \
+    $$DESKTOP/misc/tilecodec.h \
+    $$DESKTOP/misc/strokebuffer.h \
+    $$DESKTOP/misc/shortcutmanager.h \
+    $$DESKTOP/paintingTools/brush/brushmanager.h \
+    $$DESKTOP/paintingTools/brush/abstractbrush.h \
+    $$DESKTOP/paintingTools/brush/basicbrush.h \
+    $$DESKTOP/paintingTools/brush/basiceraser.h \
+    $$DESKTOP/paintingTools/brush/binarybrush.h \
+    $$DESKTOP/paintingTools/brush/brushfeature.h \
+    $$DESKTOP/paintingTools/brush/brushsettings.h \
+    $$DESKTOP/paintingTools/brush/maskbased.h \
+    $$DESKTOP/paintingTools/brush/sketchbrush.h \
+    $$DESKTOP/paintingTools/brush/waterbased.h \
+    $$DESKTOP/paintingTools/brush/dabblitter.h \
+    $$DESKTOP/paintingTools/brush/capsulerasterizer.h \
+    $$DESKTOP/paintingTools/brush/strokewash.h
+
+# MaskBased loads its paper texture from here
+RESOURCES += $$DESKTOP/resources.qrc
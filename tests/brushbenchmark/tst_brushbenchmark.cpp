@@ -0,0 +1,119 @@
+#include <QtTest>
+#include <QDir>
+#include "brushbenchmark.h"
+#include "brushmanager.h"
+#include "waterbased.h"
+#include "singleton.h"
+
+/*
+    Benchmarks every brush, and checks what it draws against golden
+    images in tests/brushbenchmark/golden, named <brush>-<stroke>.png.
+    Runs headless:
+
+        QT_QPA_PLATFORM=offscreen ./tst_brushbenchmark
+
+    With BRUSHBENCHMARK_UPDATE_GOLDEN=1 in the environment, the renders
+    are written as the new golden images instead. Do that only after
+    checking that a change to the renders is meant to be.
+*/
+
+static const int MSECS = 200;
+// the largest channel difference a render may have from its golden image
+static const int TOLERANCE = 2;
+
+class tst_BrushBenchmark : public QObject
+{
+    Q_OBJECT
+private slots:
+    void initTestCase();
+    void dabs_data();
+    void dabs();
+    void replay_data();
+    void replay();
+private:
+    BrushManager &manager();
+};
+
+BrushManager &tst_BrushBenchmark::manager()
+{
+    return Singleton<BrushManager>::instance();
+}
+
+void tst_BrushBenchmark::initTestCase()
+{
+    manager().addBuiltinBrushes();
+    // not offered in the client yet, but measured all the same
+    BrushPointer water(new WaterBased);
+    water->setSettings(water->defaultSettings());
+    manager().addBrush(water);
+}
+
+void tst_BrushBenchmark::dabs_data()
+{
+    QTest::addColumn<QString>("brush");
+    QTest::addColumn<bool>("pressure");
+    for(const BrushPointer &brush : manager().allBrushes()){
+        const QString name = brush->name().toLower();
+        QTest::newRow(qPrintable(name)) << name << false;
+        QTest::newRow(qPrintable(name + "-pressure")) << name << true;
+    }
+}
+
+void tst_BrushBenchmark::dabs()
+{
+    QFETCH(QString, brush);
+    QFETCH(bool, pressure);
+    const BrushBenchmark::Result result
+            = BrushBenchmark::run(manager().makeBrush(brush), pressure, MSECS);
+    qDebug() << qPrintable(result.toString());
+    QVERIFY(result.dabs > 0);
+}
+
+void tst_BrushBenchmark::replay_data()
+{
+    QTest::addColumn<QString>("brush");
+    QTest::addColumn<int>("stroke");
+    const QVector<BrushBenchmark::Stroke> strokes = BrushBenchmark::corpus();
+    for(const BrushPointer &brush : manager().allBrushes()){
+        const QString name = brush->name().toLower();
+        for(int i = 0; i < strokes.count(); ++i){
+            QTest::newRow(qPrintable(name + "-" + strokes[i].name)) << name << i;
+        }
+    }
+}
+
+void tst_BrushBenchmark::replay()
+{
+    QFETCH(QString, brush);
+    QFETCH(int, stroke);
+    const BrushBenchmark::Stroke &line = BrushBenchmark::corpus()[stroke];
+    const BrushBenchmark::Replay replayed
+            = BrushBenchmark::replay(manager().makeBrush(brush), line, MSECS);
+    qDebug() << qPrintable(replayed.toString());
+    QVERIFY(!replayed.image.isNull());
+
+    QDir dir(GOLDEN_DIR);
+    const QString file = dir.filePath(QString("%1-%2.png")
+                                      .arg(brush, line.name));
+    if(qgetenv("BRUSHBENCHMARK_UPDATE_GOLDEN") == "1"){
+        dir.mkpath(".");
+        QVERIFY2(replayed.image.save(file),
+                 qPrintable("cannot write " + file));
+        return;
+    }
+    const QImage golden(file);
+    if(golden.isNull()){
+        // not recorded yet, nothing to compare with
+        QSKIP(qPrintable("no golden image " + file + ", record it with "
+                         "BRUSHBENCHMARK_UPDATE_GOLDEN=1"));
+    }
+    const int diff = BrushBenchmark::compare(replayed.image, golden);
+    QVERIFY2(diff >= 0, "the golden image has another size");
+    QVERIFY2(diff <= TOLERANCE,
+             qPrintable(QString("differs from the golden image by %1")
+                        .arg(diff)));
+}
+
+QTEST_MAIN(tst_BrushBenchmark)
+
+#include "tst_brushbenchmark.moc"